@@ -284,6 +284,11 @@ int secondPass(FILE *inFilePtr, FILE *outFilePtr) {
         instruction = oTypeInstruction(0b110);
       else if (!strcmp(opcode, "noop"))
         instruction = oTypeInstruction(0b111);
+      else if (!strcmp(opcode, "swap")) {
+        /* extension: opcode 0b000 with the lowest unused bit set */
+        instruction = iTypeInstruction(0b000, arg0, arg1, arg2, -1);
+        instruction.i.unused = 0b0000001;
+      }
       else {
         printf("error: unrecognized opcodes\n");
         printf("%s\n", opcode);
@@ -5,6 +5,7 @@
 #define NUMMEMORY 65536
 #define NUMREGS 8
 #define MAXLINELENGTH 1000
+#define SWAPOPCODE 0b1000 /* opcode 0b000 with the lowest unused bit set */
 
 struct inst_t {
   union {
@@ -50,17 +51,127 @@ typedef struct stateStruct {
   int numMemory;
 } stateType;
 
+#define MAXLABELS 1024
+#define MAXLABELLENGTH 100
+#define MAXWATCHES 16
+#define SNAPINTERVAL 1024 /* instructions between reverse-step snapshots */
+#define NUMSNAPS 16
+
+typedef struct debugStruct {
+  unsigned char breakMap[NUMMEMORY]; /* nonzero where a breakpoint is set */
+  int watchAddr[MAXWATCHES];
+  int watchValue[MAXWATCHES];
+  int numWatches;
+  int watchRegs[NUMREGS];
+  int watchRegValue[NUMREGS];
+  int numWatchRegs;
+  struct {
+    char label[MAXLABELLENGTH];
+    int addr;
+  } labels[MAXLABELS];
+  int numLabels;
+  stateType *initial;     /* state before the first instruction */
+  stateType *snaps;       /* ring of periodic snapshots */
+  long snapStep[NUMSNAPS];
+  long steps;             /* instructions executed so far */
+  int halted;
+} debugType;
+
+#define MAXLANES 1024
+#define MAXSWEEPS 16
+#define LANEHALTED 1
+#define LANEFAULT 2 /* memory access or jump outside of NUMMEMORY */
+#define LANETIMEOUT 3
+#define LANEBLOCK 32 /* lanes stepped together; constant so loops vectorize */
+
+typedef struct sweepStruct {
+  int addr;
+  int base;
+  int stride;
+} sweepType;
+
+/*
+ * K machine instances stored lane-major so each register is a vector. The
+ * rows are padded to whole blocks of LANEBLOCK lanes; the padding lanes
+ * start out stopped.
+ */
+typedef struct laneStruct {
+  int numLanes;
+  int width;     /* numLanes rounded up to a multiple of LANEBLOCK */
+  int numMemory; /* words allocated per lane, grown as lanes touch more */
+  int *pc;       /* pc[lane]; NUMMEMORY once the lane has stopped */
+  int *reg;      /* reg[r * width + lane] */
+  int *mem;      /* mem[addr * width + lane] */
+  long *count;   /* instructions executed by each lane */
+  int *status;
+  int *blockPc;  /* lowest pc of any lane in each block */
+  long max;      /* instructions a lane may run, or 0 for no limit */
+} laneType;
+
+#define OUTBUFSIZE (1 << 20)
+
+/* structured output is collected here and written out in large chunks */
+char outBuf[OUTBUFSIZE];
+int outLen;
+
 void printState(stateType *);
+int step(stateType *);
+int runJson(stateType *);
+void readLabels(debugType *, char *);
+int debugAddress(debugType *, char *);
+int runDebugger(stateType *, debugType *);
+int runLanes(stateType *, int, sweepType *, int, int, unsigned int, long,
+             int);
 
 int main(int argc, char *argv[]) {
   char line[MAXLINELENGTH];
   stateType state = { 0, };
-  struct inst_t instruction;
   FILE *filePtr;
   int numInstructions;
+  int debug = 0;
+  int json = 0;
+  char *labelFile = NULL;
+  static debugType debugger;
+  int numLanes = 0, numSweeps = 0, check = 0, randomize = 0;
+  unsigned int seed = 0;
+  long maxInstructions = 0;
+  char *sweepArgs[MAXSWEEPS];
+  sweepType sweeps[MAXSWEEPS];
+  char name[MAXLINELENGTH];
 
-  if (argc != 2) {
-    printf("error: usage: %s <machine-code file>\n", argv[0]);
+  while (argc > 2 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-d")) {
+      debug = 1;
+    } else if (!strcmp(argv[1], "-c")) {
+      check = 1;
+    } else if (!strcmp(argv[1], "-j")) {
+      json = 1;
+    } else if (argc > 3 && !strcmp(argv[1], "-l")) {
+      labelFile = argv[2];
+      argc--, argv++;
+    } else if (argc > 3 && !strcmp(argv[1], "-k")) {
+      numLanes = atoi(argv[2]);
+      argc--, argv++;
+    } else if (argc > 3 && !strcmp(argv[1], "-s") && numSweeps < MAXSWEEPS) {
+      sweepArgs[numSweeps++] = argv[2];
+      argc--, argv++;
+    } else if (argc > 3 && !strcmp(argv[1], "-r")) {
+      randomize = 1;
+      seed = atoi(argv[2]);
+      argc--, argv++;
+    } else if (argc > 3 && !strcmp(argv[1], "-m")) {
+      maxInstructions = atol(argv[2]);
+      argc--, argv++;
+    } else {
+      break;
+    }
+    argc--, argv++;
+  }
+
+  if (argc != 2 || numLanes < 0 || numLanes > MAXLANES) {
+    printf("error: usage: %s [-d] [-j] [-l <assembly-code file>] "
+           "[-k <lanes> [-s <addr|label>[:<base>[:<stride>]]]... [-r <seed>] "
+           "[-m <max instructions>] [-c]] <machine-code file>\n", argv[0]);
     exit(1);
   }
   
@@ -78,7 +189,35 @@ int main(int argc, char *argv[]) {
       printf("error in reading address %d\n", state.numMemory);
       exit(1);
     }
-    printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+    if (!json)
+      printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+  }
+
+  if (labelFile != NULL)
+    readLabels(&debugger, labelFile);
+
+  if (debug)
+    return runDebugger(&state, &debugger);
+
+  if (json)
+    return runJson(&state);
+
+  if (numLanes > 0) {
+    for (int i = 0; i < numSweeps; i++) {
+      name[0] = '\0';
+      sscanf(sweepArgs[i], "%[^:]", name);
+      sweeps[i].addr = debugAddress(&debugger, name);
+      if (sweeps[i].addr < 0) {
+        printf("error: unknown sweep address %s\n", name);
+        exit(1);
+      }
+      sweeps[i].base = state.mem[sweeps[i].addr];
+      sweeps[i].stride = 1;
+      sscanf(sweepArgs[i], "%*[^:]:%d:%d", &sweeps[i].base,
+             &sweeps[i].stride);
+    }
+    return runLanes(&state, numLanes, sweeps, numSweeps, randomize, seed,
+                    maxInstructions, check);
   }
 
   numInstructions = 0;
@@ -86,25 +225,8 @@ int main(int argc, char *argv[]) {
     numInstructions++;
 
     printState(&state);
-    instruction.code = state.mem[state.pc++];
-
-    if (instruction.o.opcode == 0b000)
-      state.reg[instruction.r.destReg] = state.reg[instruction.r.regA] + state.reg[instruction.r.regB];
-    else if (instruction.o.opcode == 0b001)
-      state.reg[instruction.r.destReg] = ~(state.reg[instruction.r.regA] | state.reg[instruction.r.regB]);
-    else if (instruction.o.opcode == 0b010)
-      state.reg[instruction.i.regB] = state.mem[state.reg[instruction.i.regA] + instruction.i.offset];
-    else if (instruction.o.opcode == 0b011)
-      state.mem[state.reg[instruction.i.regA] + instruction.i.offset] = state.reg[instruction.i.regB];
-    else if (instruction.o.opcode == 0b100)
-      state.pc += instruction.i.offset * (state.reg[instruction.i.regA] == state.reg[instruction.i.regB]);
-    else if (instruction.o.opcode == 0b101)
-      state.reg[instruction.j.regB] = state.pc, state.pc = state.reg[instruction.j.regA]; 
-    else if (instruction.o.opcode == 0b110)
+    if (step(&state))
       break;
-    else if (instruction.o.opcode == 0b111)
-      ;
-
   }
 
   printf("machine halted\n");
@@ -115,6 +237,663 @@ int main(int argc, char *argv[]) {
   return (0);
 }
 
+/* execute the instruction at pc; return 1 if it was halt */
+int step(stateType *statePtr) {
+  struct inst_t instruction;
+
+  int addr, old;
+
+  instruction.code = statePtr->mem[statePtr->pc++];
+
+  if (instruction.code >> 22 == SWAPOPCODE) {
+    addr = statePtr->reg[instruction.i.regA] + instruction.i.offset;
+    old = statePtr->mem[addr];
+    statePtr->mem[addr] = statePtr->reg[instruction.i.regB];
+    statePtr->reg[instruction.i.regB] = old;
+  }
+  else if (instruction.o.opcode == 0b000)
+    statePtr->reg[instruction.r.destReg] = statePtr->reg[instruction.r.regA] + statePtr->reg[instruction.r.regB];
+  else if (instruction.o.opcode == 0b001)
+    statePtr->reg[instruction.r.destReg] = ~(statePtr->reg[instruction.r.regA] | statePtr->reg[instruction.r.regB]);
+  else if (instruction.o.opcode == 0b010)
+    statePtr->reg[instruction.i.regB] = statePtr->mem[statePtr->reg[instruction.i.regA] + instruction.i.offset];
+  else if (instruction.o.opcode == 0b011)
+    statePtr->mem[statePtr->reg[instruction.i.regA] + instruction.i.offset] = statePtr->reg[instruction.i.regB];
+  else if (instruction.o.opcode == 0b100)
+    statePtr->pc += instruction.i.offset * (statePtr->reg[instruction.i.regA] == statePtr->reg[instruction.i.regB]);
+  else if (instruction.o.opcode == 0b101)
+    statePtr->reg[instruction.j.regB] = statePtr->pc, statePtr->pc = statePtr->reg[instruction.j.regA];
+  else if (instruction.o.opcode == 0b110)
+    return 1;
+  else if (instruction.o.opcode == 0b111)
+    ;
+
+  return 0;
+}
+
+void readLabels(debugType *debugPtr, char *fileName) {
+  /* labels are the first column of the assembly file, one line per address */
+  char line[MAXLINELENGTH];
+  char label[MAXLABELLENGTH];
+  FILE *filePtr;
+  int addr;
+
+  filePtr = fopen(fileName, "r");
+  if (filePtr == NULL) {
+    printf("error: can't open file %s", fileName);
+    perror("fopen");
+    exit(1);
+  }
+  for (addr = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL; addr++) {
+    if (debugPtr->numLabels == MAXLABELS)
+      break;
+    if (sscanf(line, "%99[^\t\n\r ]", label) == 1) {
+      strcpy(debugPtr->labels[debugPtr->numLabels].label, label);
+      debugPtr->labels[debugPtr->numLabels].addr = addr;
+      debugPtr->numLabels++;
+    }
+  }
+  fclose(filePtr);
+}
+
+/* parse an address given as a number or a label; return -1 if unknown */
+int debugAddress(debugType *debugPtr, char *arg) {
+  int addr;
+  if (sscanf(arg, "%d", &addr) == 1)
+    return (addr >= 0 && addr < NUMMEMORY) ? addr : -1;
+  for (int i = 0; i < debugPtr->numLabels; i++) {
+    if (!strcmp(arg, debugPtr->labels[i].label))
+      return debugPtr->labels[i].addr;
+  }
+  return -1;
+}
+
+/* show the word at pc disassembled in the field layout of its format */
+void debugPrintPc(stateType *statePtr) {
+  static const char *names[] = { "add", "nor", "lw", "sw",
+                                 "beq", "jalr", "halt", "noop" };
+  struct inst_t instruction;
+  instruction.code = statePtr->mem[statePtr->pc];
+  printf("pc %d: %d (", statePtr->pc, instruction.code);
+  if (instruction.code >> 22 == SWAPOPCODE)
+    printf("swap %d %d %d", instruction.i.regA, instruction.i.regB,
+           instruction.i.offset);
+  else if (instruction.code >> 22 > 0b111)
+    printf(".fill");
+  else if (instruction.o.opcode <= 0b001)
+    printf("%s %d %d %d", names[instruction.o.opcode], instruction.r.regA,
+           instruction.r.regB, instruction.r.destReg);
+  else if (instruction.o.opcode <= 0b100)
+    printf("%s %d %d %d", names[instruction.o.opcode], instruction.i.regA,
+           instruction.i.regB, instruction.i.offset);
+  else if (instruction.o.opcode == 0b101)
+    printf("jalr %d %d", instruction.j.regA, instruction.j.regB);
+  else
+    printf("%s", names[instruction.o.opcode]);
+  printf(")\n");
+}
+
+/* advance one instruction, taking a snapshot every SNAPINTERVAL steps */
+void debugStep(stateType *statePtr, debugType *debugPtr) {
+  int slot;
+  if (debugPtr->halted)
+    return;
+  if (debugPtr->steps % SNAPINTERVAL == 0 && debugPtr->steps > 0) {
+    slot = (debugPtr->steps / SNAPINTERVAL) % NUMSNAPS;
+    debugPtr->snaps[slot] = *statePtr;
+    debugPtr->snapStep[slot] = debugPtr->steps;
+  }
+  debugPtr->halted = step(statePtr);
+  debugPtr->steps++;
+}
+
+/* return 1 and report if any watched word or register changed */
+int debugWatch(stateType *statePtr, debugType *debugPtr) {
+  int hit = 0;
+  int addr, reg;
+  for (int i = 0; i < debugPtr->numWatches; i++) {
+    addr = debugPtr->watchAddr[i];
+    if (statePtr->mem[addr] != debugPtr->watchValue[i]) {
+      printf("watch mem[ %d ] %d -> %d\n", addr, debugPtr->watchValue[i],
+             statePtr->mem[addr]);
+      debugPtr->watchValue[i] = statePtr->mem[addr];
+      hit = 1;
+    }
+  }
+  for (int i = 0; i < debugPtr->numWatchRegs; i++) {
+    reg = debugPtr->watchRegs[i];
+    if (statePtr->reg[reg] != debugPtr->watchRegValue[i]) {
+      printf("watch reg[ %d ] %d -> %d\n", reg, debugPtr->watchRegValue[i],
+             statePtr->reg[reg]);
+      debugPtr->watchRegValue[i] = statePtr->reg[reg];
+      hit = 1;
+    }
+  }
+  return hit;
+}
+
+/* re-sync watch values after the state was changed behind their back */
+void debugRewatch(stateType *statePtr, debugType *debugPtr) {
+  for (int i = 0; i < debugPtr->numWatches; i++)
+    debugPtr->watchValue[i] = statePtr->mem[debugPtr->watchAddr[i]];
+  for (int i = 0; i < debugPtr->numWatchRegs; i++)
+    debugPtr->watchRegValue[i] = statePtr->reg[debugPtr->watchRegs[i]];
+}
+
+/* restore the state as it was after `target` instructions */
+void debugRewind(stateType *statePtr, debugType *debugPtr, long target) {
+  long k, slot;
+  *statePtr = *debugPtr->initial;
+  debugPtr->steps = 0;
+  for (k = target / SNAPINTERVAL; k > 0 && k > target / SNAPINTERVAL - NUMSNAPS;
+       k--) {
+    slot = k % NUMSNAPS;
+    if (debugPtr->snapStep[slot] == k * SNAPINTERVAL) {
+      *statePtr = debugPtr->snaps[slot];
+      debugPtr->steps = debugPtr->snapStep[slot];
+      break;
+    }
+  }
+  debugPtr->halted = 0;
+  while (debugPtr->steps < target)
+    debugStep(statePtr, debugPtr);
+  debugRewatch(statePtr, debugPtr);
+}
+
+int runDebugger(stateType *statePtr, debugType *debugPtr) {
+  char line[MAXLINELENGTH], cmd[MAXLINELENGTH], arg[MAXLINELENGTH];
+  int numArgs, addr, count;
+
+  debugPtr->initial = malloc(sizeof(stateType));
+  debugPtr->snaps = malloc(NUMSNAPS * sizeof(stateType));
+  if (debugPtr->initial == NULL || debugPtr->snaps == NULL) {
+    printf("error: out of memory for debugger snapshots\n");
+    exit(1);
+  }
+  *debugPtr->initial = *statePtr;
+  for (int i = 0; i < NUMSNAPS; i++)
+    debugPtr->snapStep[i] = -1;
+
+  debugPrintPc(statePtr);
+  for (;;) {
+    printf("(dbg) ");
+    fflush(stdout);
+    if (fgets(line, MAXLINELENGTH, stdin) == NULL)
+      break;
+    arg[0] = '\0';
+    numArgs = sscanf(line, "%s %s", cmd, arg);
+    if (numArgs < 1)
+      continue;
+
+    if (!strcmp(cmd, "s") || !strcmp(cmd, "c")) {
+      /* step n instructions, or continue until something stops us */
+      count = 1;
+      if (!strcmp(cmd, "s") && numArgs == 2)
+        count = atoi(arg);
+      for (int i = 0; !debugPtr->halted; i++) {
+        if (!strcmp(cmd, "s") && i == count)
+          break;
+        if (i > 0 && debugPtr->breakMap[statePtr->pc]) {
+          printf("breakpoint at %d\n", statePtr->pc);
+          break;
+        }
+        debugStep(statePtr, debugPtr);
+        if ((debugPtr->numWatches || debugPtr->numWatchRegs) &&
+            debugWatch(statePtr, debugPtr))
+          break;
+      }
+      if (debugPtr->halted)
+        printf("machine halted after %ld instructions\n", debugPtr->steps);
+      else
+        debugPrintPc(statePtr);
+    } else if (!strcmp(cmd, "rs")) {
+      count = numArgs == 2 ? atoi(arg) : 1;
+      if (count > debugPtr->steps)
+        count = debugPtr->steps;
+      debugRewind(statePtr, debugPtr, debugPtr->steps - count);
+      debugPrintPc(statePtr);
+    } else if (!strcmp(cmd, "b") || !strcmp(cmd, "d")) {
+      if ((addr = debugAddress(debugPtr, arg)) < 0) {
+        printf("unknown address %s\n", arg);
+      } else {
+        debugPtr->breakMap[addr] = cmd[0] == 'b';
+      }
+    } else if (!strcmp(cmd, "w")) {
+      if ((addr = debugAddress(debugPtr, arg)) < 0 ||
+          debugPtr->numWatches == MAXWATCHES) {
+        printf("can't watch %s\n", arg);
+      } else {
+        debugPtr->watchAddr[debugPtr->numWatches] = addr;
+        debugPtr->watchValue[debugPtr->numWatches++] = statePtr->mem[addr];
+      }
+    } else if (!strcmp(cmd, "wr")) {
+      addr = atoi(arg);
+      if (numArgs != 2 || addr < 0 || addr >= NUMREGS ||
+          debugPtr->numWatchRegs == NUMREGS) {
+        printf("can't watch register %s\n", arg);
+      } else {
+        debugPtr->watchRegs[debugPtr->numWatchRegs] = addr;
+        debugPtr->watchRegValue[debugPtr->numWatchRegs++] = statePtr->reg[addr];
+      }
+    } else if (!strcmp(cmd, "p")) {
+      printState(statePtr);
+    } else if (!strcmp(cmd, "x")) {
+      if ((addr = debugAddress(debugPtr, arg)) < 0)
+        printf("unknown address %s\n", arg);
+      else
+        printf("mem[ %d ] %d\n", addr, statePtr->mem[addr]);
+    } else if (!strcmp(cmd, "r")) {
+      for (int i = 0; i < NUMREGS; i++)
+        printf("reg[ %d ] %d\n", i, statePtr->reg[i]);
+    } else if (!strcmp(cmd, "q")) {
+      break;
+    } else {
+      printf("commands: s [n]  c  rs [n]  b|d <addr|label>  w <addr|label>  "
+             "wr <reg>  x <addr|label>  r  p  q\n");
+    }
+  }
+
+  free(debugPtr->initial);
+  free(debugPtr->snaps);
+  return (0);
+}
+
+/* initial value of a swept word in the given lane */
+int sweepValue(sweepType *sweepPtr, int lane, int randomize) {
+  if (randomize)
+    return (rand() & 0xffff) - 0x8000;
+  return sweepPtr->base + lane * sweepPtr->stride;
+}
+
+/* make sure every lane has at least `size` words of memory */
+void growLanes(laneType *lanePtr, int size) {
+  int k = lanePtr->width;
+  int old = lanePtr->numMemory;
+  int *mem;
+
+  if (size <= old)
+    return;
+  if (size < 2 * old)
+    size = 2 * old < NUMMEMORY ? 2 * old : NUMMEMORY;
+  /* lane-major rows, so the new addresses are simply appended */
+  mem = realloc(lanePtr->mem, (size_t) size * k * sizeof(int));
+  if (mem == NULL) {
+    printf("error: out of memory for %d lanes\n", lanePtr->numLanes);
+    exit(1);
+  }
+  memset(mem + (size_t) old * k, 0, (size_t) (size - old) * k * sizeof(int));
+  lanePtr->mem = mem;
+  lanePtr->numMemory = size;
+}
+
+/*
+ * Execute the instruction at pc p for every lane parked on it, one block
+ * of LANEBLOCK lanes at a time, skipping blocks with no lane at p. Within
+ * a block the mask is a local array of 0 or -1 and add, nor, beq and the
+ * pc update are arithmetic selects into local temporaries, so each loop
+ * has a constant trip count and no possible aliasing and compiles to SIMD
+ * code even at -O2. Loads, stores, jalr and halt go lane by lane.
+ */
+void stepLanes(laneType *lanePtr, int p) {
+  int k = lanePtr->width;
+  int m[LANEBLOCK], t[LANEBLOCK];
+  int *pc, *word, *ra, *rb, *rd, *status;
+  long *count, max = lanePtr->max;
+  int base, any, bad, lo, addr, old, swap, offset, first;
+  struct inst_t instruction;
+
+  growLanes(lanePtr, p + 1);
+
+  /* lanes that diverged onto different code at the same pc regroup later */
+  for (first = 0; lanePtr->blockPc[first / LANEBLOCK] != p; first += LANEBLOCK)
+    ;
+  while (lanePtr->pc[first] != p)
+    first++;
+  instruction.code = lanePtr->mem[p * k + first];
+  swap = instruction.code >> 22 == SWAPOPCODE;
+  offset = instruction.i.offset;
+
+  for (base = first - first % LANEBLOCK; base < k; base += LANEBLOCK) {
+    if (lanePtr->blockPc[base / LANEBLOCK] != p)
+      continue;
+    pc = lanePtr->pc + base;
+    word = lanePtr->mem + p * k + base;
+    count = lanePtr->count + base;
+    status = lanePtr->status + base;
+    ra = lanePtr->reg + instruction.i.regA * k + base;
+    rb = lanePtr->reg + instruction.i.regB * k + base;
+    rd = lanePtr->reg + instruction.r.destReg * k + base;
+
+    any = 0;
+    for (int l = 0; l < LANEBLOCK; l++) {
+      m[l] = -((pc[l] == p) & (word[l] == (int) instruction.code));
+      any |= m[l];
+    }
+    if (!any)
+      continue;
+    for (int l = 0; l < LANEBLOCK; l++)
+      count[l] += m[l] & 1;
+
+    if (instruction.o.opcode == 0b000 && !swap) {
+      for (int l = 0; l < LANEBLOCK; l++)
+        t[l] = ra[l] + rb[l];
+      for (int l = 0; l < LANEBLOCK; l++)
+        rd[l] = (t[l] & m[l]) | (rd[l] & ~m[l]);
+    } else if (instruction.o.opcode == 0b001) {
+      for (int l = 0; l < LANEBLOCK; l++)
+        t[l] = ~(ra[l] | rb[l]);
+      for (int l = 0; l < LANEBLOCK; l++)
+        rd[l] = (t[l] & m[l]) | (rd[l] & ~m[l]);
+    } else if (swap || instruction.o.opcode == 0b010 ||
+               instruction.o.opcode == 0b011) {
+      for (int l = 0; l < LANEBLOCK; l++) {
+        if (!m[l])
+          continue;
+        addr = ra[l] + offset;
+        if (addr < 0 || addr >= NUMMEMORY) {
+          status[l] = LANEFAULT;
+          m[l] = 0;
+          pc[l] = NUMMEMORY;
+          continue;
+        }
+        growLanes(lanePtr, addr + 1);
+        if (swap) {
+          old = lanePtr->mem[addr * k + base + l];
+          lanePtr->mem[addr * k + base + l] = rb[l];
+          rb[l] = old;
+        } else if (instruction.o.opcode == 0b010) {
+          rb[l] = lanePtr->mem[addr * k + base + l];
+        } else {
+          lanePtr->mem[addr * k + base + l] = rb[l];
+        }
+      }
+    } else if (instruction.o.opcode == 0b100) {
+      for (int l = 0; l < LANEBLOCK; l++)
+        t[l] = offset & -(ra[l] == rb[l]);
+      for (int l = 0; l < LANEBLOCK; l++)
+        pc[l] += t[l] & m[l];
+    } else if (instruction.o.opcode == 0b101) {
+      for (int l = 0; l < LANEBLOCK; l++) {
+        if (m[l]) {
+          rb[l] = p + 1;
+          pc[l] = ra[l] - 1;
+        }
+      }
+    } else if (instruction.o.opcode == 0b110) {
+      for (int l = 0; l < LANEBLOCK; l++) {
+        if (m[l]) {
+          status[l] = LANEHALTED;
+          pc[l] = NUMMEMORY - 1;
+        }
+      }
+    }
+
+    /* m is -1 for the lanes that ran, so this moves them on by one */
+    bad = 0;
+    lo = NUMMEMORY;
+    for (int l = 0; l < LANEBLOCK; l++) {
+      pc[l] -= m[l];
+      bad |= m[l] & -((unsigned int) pc[l] >= NUMMEMORY);
+      lo = pc[l] < lo ? pc[l] : lo;
+    }
+    if (max > 0) {
+      for (int l = 0; l < LANEBLOCK; l++)
+        bad |= m[l] & -(count[l] >= max);
+    }
+
+    /* rare: a lane halted, jumped out of memory or ran out of time */
+    if (bad) {
+      lo = NUMMEMORY;
+      for (int l = 0; l < LANEBLOCK; l++) {
+        if (m[l] && (pc[l] < 0 || (pc[l] >= NUMMEMORY && !status[l]))) {
+          status[l] = LANEFAULT;
+          pc[l] = NUMMEMORY;
+        }
+        if (m[l] && max > 0 && count[l] >= max &&
+            pc[l] != NUMMEMORY) {
+          status[l] = LANETIMEOUT;
+          pc[l] = NUMMEMORY;
+        }
+        lo = pc[l] < lo ? pc[l] : lo;
+      }
+    }
+    lanePtr->blockPc[base / LANEBLOCK] = lo;
+  }
+}
+
+/* rerun one lane with the scalar simulator; return 1 if the results differ */
+int checkLane(stateType *initialPtr, sweepType *sweeps, int numSweeps,
+              int *initial, laneType *lanePtr, int lane, long max) {
+  static stateType state;
+  long count = 0;
+  int k = lanePtr->numLanes, w = lanePtr->width;
+
+  /* step() does no bounds checking, so faulting lanes can't be replayed */
+  if (lanePtr->status[lane] == LANEFAULT)
+    return 0;
+
+  state = *initialPtr;
+  for (int i = 0; i < numSweeps; i++)
+    state.mem[sweeps[i].addr] = initial[i * k + lane];
+  do {
+    count++;
+  } while (!step(&state) && count != max);
+
+  if (count != lanePtr->count[lane])
+    return 1;
+  for (int r = 0; r < NUMREGS; r++) {
+    if (state.reg[r] != lanePtr->reg[r * w + lane])
+      return 1;
+  }
+  /* words past numMemory were never stored to by this lane */
+  for (int a = 0; a < lanePtr->numMemory; a++) {
+    if (state.mem[a] != lanePtr->mem[a * w + lane])
+      return 1;
+  }
+  return 0;
+}
+
+int runLanes(stateType *statePtr, int numLanes, sweepType *sweeps,
+             int numSweeps, int randomize, unsigned int seed, long max,
+             int check) {
+  laneType lanes;
+  int k = numLanes;
+  int w = (numLanes + LANEBLOCK - 1) / LANEBLOCK * LANEBLOCK;
+  int p, mismatches = 0;
+  int *initial;
+
+  lanes.numLanes = k;
+  lanes.width = w;
+  lanes.numMemory = statePtr->numMemory > 0 ? statePtr->numMemory : 1;
+  lanes.max = max;
+  lanes.pc = calloc(w, sizeof(int));
+  lanes.reg = calloc(NUMREGS * w, sizeof(int));
+  lanes.mem = calloc((size_t) lanes.numMemory * w, sizeof(int));
+  lanes.count = calloc(w, sizeof(long));
+  lanes.status = calloc(w, sizeof(int));
+  lanes.blockPc = calloc(w / LANEBLOCK, sizeof(int));
+  initial = calloc((size_t) numSweeps * k, sizeof(int));
+  if (lanes.pc == NULL || lanes.reg == NULL || lanes.mem == NULL ||
+      lanes.count == NULL || lanes.status == NULL || lanes.blockPc == NULL ||
+      initial == NULL) {
+    printf("error: out of memory for %d lanes\n", k);
+    exit(1);
+  }
+  for (int l = k; l < w; l++) {
+    lanes.pc[l] = NUMMEMORY;
+    lanes.status[l] = LANEHALTED;
+  }
+
+  for (int i = 0; i < numSweeps; i++)
+    growLanes(&lanes, sweeps[i].addr + 1);
+  srand(seed);
+  for (int a = 0; a < statePtr->numMemory; a++) {
+    for (int l = 0; l < w; l++)
+      lanes.mem[a * w + l] = statePtr->mem[a];
+  }
+  for (int l = 0; l < k; l++) {
+    for (int i = 0; i < numSweeps; i++) {
+      initial[i * k + l] = sweepValue(&sweeps[i], l, randomize);
+      lanes.mem[sweeps[i].addr * w + l] = initial[i * k + l];
+    }
+  }
+
+  /*
+   * Always issue the lowest pc any running lane is waiting at: lanes that
+   * branched ahead wait for the stragglers, so loops and if/else joins
+   * reconverge and the lanes run in lockstep again.
+   */
+  for (;;) {
+    p = NUMMEMORY;
+    for (int b = 0; b < w / LANEBLOCK; b++)
+      p = lanes.blockPc[b] < p ? lanes.blockPc[b] : p;
+    if (p == NUMMEMORY)
+      break;
+    stepLanes(&lanes, p);
+  }
+
+  for (int l = 0; l < k; l++) {
+    printf("lane %d:", l);
+    for (int i = 0; i < numSweeps; i++)
+      printf(" mem[ %d ]=%d", sweeps[i].addr, initial[i * k + l]);
+    if (lanes.status[l] == LANEHALTED)
+      printf(" halted after %ld instructions;", lanes.count[l]);
+    else if (lanes.status[l] == LANEFAULT)
+      printf(" faulted after %ld instructions;", lanes.count[l]);
+    else
+      printf(" stopped after %ld instructions;", lanes.count[l]);
+    printf(" registers");
+    for (int r = 0; r < NUMREGS; r++)
+      printf(" %d", lanes.reg[r * w + l]);
+    printf("\n");
+  }
+
+  if (check) {
+    for (int l = 0; l < k; l++)
+      mismatches += checkLane(statePtr, sweeps, numSweeps, initial, &lanes, l,
+                              max);
+    printf("%d of %d lanes differ from the scalar simulator\n", mismatches,
+           k);
+  }
+
+  free(lanes.pc);
+  free(lanes.reg);
+  free(lanes.mem);
+  free(lanes.blockPc);
+  free(lanes.count);
+  free(lanes.status);
+  free(initial);
+  return (mismatches != 0);
+}
+
+void outFlush(void) {
+  fwrite(outBuf, 1, outLen, stdout);
+  outLen = 0;
+}
+
+void outString(const char *string) {
+  int length = strlen(string);
+  if (outLen + length > OUTBUFSIZE)
+    outFlush();
+  memcpy(outBuf + outLen, string, length);
+  outLen += length;
+}
+
+void outInt(int n) {
+  char digits[10];
+  int numDigits = 0;
+  unsigned int u = n < 0 ? -(unsigned int) n : (unsigned int) n;
+
+  if (outLen + 11 > OUTBUFSIZE)
+    outFlush();
+  if (n < 0)
+    outBuf[outLen++] = '-';
+  do {
+    digits[numDigits++] = '0' + u % 10;
+  } while (u /= 10);
+  while (numDigits)
+    outBuf[outLen++] = digits[--numDigits];
+}
+
+/* emit `"key":value` inside an object, opening it with `name` if needed */
+void outMember(const char *name, int *opened, int key, int value) {
+  if (!*opened) {
+    outString(",\"");
+    outString(name);
+    outString("\":{\"");
+    *opened = 1;
+  } else {
+    outString(",\"");
+  }
+  outInt(key);
+  outString("\":");
+  outInt(value);
+}
+
+void outArray(const char *name, int *values, int count) {
+  outString(",\"");
+  outString(name);
+  outString("\":[");
+  for (int i = 0; i < count; i++) {
+    if (i)
+      outString(",");
+    outInt(values[i]);
+  }
+  outString("]");
+}
+
+/*
+ * Newline-delimited JSON: one "init" record with the full machine, then one
+ * record per instruction holding only the registers and memory word that
+ * changed, then a "halt" record.
+ */
+int runJson(stateType *statePtr) {
+  int oldReg[NUMREGS];
+  int oldPc, halted, opened;
+  long steps = 0;
+  struct inst_t instruction;
+
+  outString("{\"type\":\"init\",\"pc\":");
+  outInt(statePtr->pc);
+  outArray("reg", statePtr->reg, NUMREGS);
+  outArray("mem", statePtr->mem, statePtr->numMemory);
+  outString("}\n");
+
+  do {
+    oldPc = statePtr->pc;
+    memcpy(oldReg, statePtr->reg, sizeof(oldReg));
+    instruction.code = statePtr->mem[oldPc];
+    halted = step(statePtr);
+    steps++;
+
+    outString("{\"step\":");
+    outInt(steps);
+    outString(",\"pc\":");
+    outInt(statePtr->pc);
+    opened = 0;
+    for (int i = 0; i < NUMREGS; i++) {
+      if (statePtr->reg[i] != oldReg[i])
+        outMember("reg", &opened, i, statePtr->reg[i]);
+    }
+    if (opened)
+      outString("}");
+    if (instruction.o.opcode == 0b011 ||
+        instruction.code >> 22 == SWAPOPCODE) {
+      opened = 0;
+      outMember("mem", &opened, oldReg[instruction.i.regA] + instruction.i.offset,
+                oldReg[instruction.i.regB]);
+      outString("}");
+    }
+    outString("}\n");
+  } while (!halted);
+
+  outString("{\"type\":\"halt\",\"instructions\":");
+  outInt(steps);
+  outString("}\n");
+  outFlush();
+  return (0);
+}
+
 void printState(stateType *statePtr) {
   int i;
   printf("\n@@@\nstate:\n");
@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lc2k.h"
+
+#define MAXBLOCKS 4096
+#define MAXLOOPS 256
+#define DEFAULTTRIPS 1 /* assumed when a trip count can't be worked out: the fewest there can be */
+#define BRANCHPENALTY 3 /* a taken beq squashes IFID, IDEX and EXMEM */
+#define DRAINCYCLES 3 /* halt reaches MEMWB three cycles after it is fetched */
+
+/* constant propagation lattice */
+#define UNKNOWN 0 /* no value reaches here yet */
+#define CONSTANT 1
+#define VARIES 2
+
+typedef struct regsStruct {
+	int kind[NUMREGS];
+	int value[NUMREGS];
+} regsType;
+
+typedef struct blockStruct {
+	int start; /* first and last address of the block */
+	int end;
+	int succ[2]; /* fall-through first, then the beq target */
+	int numSucc;
+	int branch; /* ends in a beq that can go either way */
+	regsType in;
+	double freq; /* estimated executions */
+	double taken; /* estimated taken branches out of this block */
+	double stalls; /* estimated load-use bubbles charged to this block */
+} blockType;
+
+typedef struct loopStruct {
+	int header;
+	unsigned char body[MAXBLOCKS];
+	int size;
+	int parent;
+	int depth;
+	int test; /* block whose beq leaves the loop, or -1 */
+	int trips; /* times the exit test runs per entry to the loop */
+	int known;
+	int reg, init, step, bound; /* induction variable, when known */
+	double cycles;
+} loopType;
+
+int mem[NUMMEMORY];
+int numMemory;
+unsigned char reached[NUMMEMORY];
+unsigned char leader[NUMMEMORY];
+unsigned char constMem[NUMMEMORY]; /* words no sw or swap can change */
+int blockOf[NUMMEMORY];
+
+blockType blocks[MAXBLOCKS];
+int numBlocks;
+unsigned char dom[MAXBLOCKS][MAXBLOCKS / 8]; /* dom[b] holds the blocks dominating b */
+loopType loops[MAXLOOPS];
+int numLoops;
+
+void findBlocks(void);
+void propagateConstants(void);
+void findDominators(void);
+void findLoops(void);
+void findTripCounts(void);
+void estimate(void);
+
+FILE *filePtr;
+
+int main(int argc, char **argv)
+{
+	char ch[1001];
+	int verbose = 0;
+	int order[MAXLOOPS];
+	int unknown = 0;
+	double total = 0, instructions = 0, stalls = 0, taken = 0;
+	clock_t begin = clock();
+
+	if (argc == 3 && !strcmp(argv[1], "-v"))
+	{
+		verbose = 1;
+		argc--, argv++;
+	}
+
+  if (argc != 2) {
+    printf("error: usage: %s [-v] <machine-code file>\n", argv[0]);
+    exit(1);
+  }
+
+  filePtr = fopen(argv[1], "r");
+  if (filePtr == NULL) {
+    printf("error: can't open file %s", argv[1]);
+    perror("fopen");
+    exit(1);
+  }
+
+	while (1)
+	{
+		if (fgets(ch, 1000, filePtr) == NULL)
+			break;
+		if (numMemory == NUMMEMORY || sscanf(ch, "%d", &mem[numMemory]) != 1)
+		{
+			printf("error read memory\n");
+			exit(1);
+		}
+		numMemory++;
+	}
+
+	findBlocks();
+	propagateConstants();
+	findDominators();
+	findLoops();
+	findTripCounts();
+	estimate();
+
+	for (int b = 0; b < numBlocks; b++)
+	{
+		instructions += blocks[b].freq * (blocks[b].end - blocks[b].start + 1);
+		stalls += blocks[b].stalls;
+		taken += blocks[b].taken;
+	}
+	total = instructions + stalls + BRANCHPENALTY * taken + DRAINCYCLES;
+
+	if (verbose)
+	{
+		for (int b = 0; b < numBlocks; b++)
+		{
+			printf("block %d-%d x%.1f\n", blocks[b].start, blocks[b].end, blocks[b].freq);
+			for (int i = blocks[b].start; i <= blocks[b].end; i++)
+			{
+				printf("\t%d\t", i);
+				printInstruction(mem[i]);
+			}
+		}
+	}
+
+	/* hottest loops first */
+	for (int l = 0; l < numLoops; l++)
+	{
+		int j = l;
+		for (; j > 0 && loops[order[j - 1]].cycles < loops[l].cycles; j--)
+			order[j] = order[j - 1];
+		order[j] = l;
+	}
+	printf("loops:\n");
+	for (int i = 0; i < numLoops; i++)
+	{
+		loopType *loopPtr = &loops[order[i]];
+		printf("\tloop at %d (depth %d): ", blocks[loopPtr->header].start, loopPtr->depth);
+		if (loopPtr->known)
+			printf("%d trips (reg %d from %d by %d until %d)", loopPtr->trips, loopPtr->reg,
+				loopPtr->init, loopPtr->step, loopPtr->bound);
+		else
+			printf("unknown trips, assumed %d", loopPtr->trips);
+		unknown |= !loopPtr->known;
+		printf(", ~%.0f cycles, %.1f%%\n", loopPtr->cycles,
+			total > 0 ? 100 * loopPtr->cycles / total : 0);
+	}
+	/* with a loop assumed to run as few times as it can, the total is a lower bound */
+	printf("estimated total of %s%.0f cycles (%.0f instructions, %.0f load-use stalls, %.0f taken branches)\n",
+		unknown ? "at least " : "", total, instructions, stalls, taken);
+	printf("analysis took %.3f ms\n", 1000.0 * (clock() - begin) / CLOCKS_PER_SEC);
+	return (0);
+}
+
+/*
+ * Mark the words reachable from address 0 as code and split them into
+ * basic blocks. jalr is not implemented by the pipeline and just falls
+ * through, so it is treated like noop here as well.
+ */
+void
+findBlocks(void)
+{
+	static int stack[NUMMEMORY];
+	int top = 0, addr, instr, target;
+
+	stack[top++] = 0;
+	leader[0] = 1;
+	while (top > 0)
+	{
+		addr = stack[--top];
+		while (addr < numMemory && !reached[addr])
+		{
+			reached[addr] = 1;
+			instr = mem[addr];
+			if (opcode(instr) == HALT)
+				break;
+			if (opcode(instr) == BEQ)
+			{
+				target = addr + 1 + getOffset(field2(instr));
+				if (target >= 0 && target < numMemory)
+				{
+					leader[target] = 1;
+					stack[top++] = target;
+				}
+				if (addr + 1 < numMemory)
+					leader[addr + 1] = 1;
+				if (field0(instr) == field1(instr))
+					break;
+			}
+			addr++;
+		}
+	}
+
+	for (addr = 0; addr < numMemory; addr++)
+	{
+		if (!reached[addr])
+			continue;
+		if (leader[addr] || addr == 0 || !reached[addr - 1])
+		{
+			if (numBlocks == MAXBLOCKS)
+			{
+				printf("error: more than %d basic blocks\n", MAXBLOCKS);
+				exit(1);
+			}
+			blocks[numBlocks].start = addr;
+			numBlocks++;
+		}
+		blocks[numBlocks - 1].end = addr;
+		blockOf[addr] = numBlocks - 1;
+	}
+
+	for (int b = 0; b < numBlocks; b++)
+	{
+		blockType *blockPtr = &blocks[b];
+		instr = mem[blockPtr->end];
+		if (opcode(instr) == HALT)
+			continue;
+		if (opcode(instr) == BEQ)
+		{
+			target = blockPtr->end + 1 + getOffset(field2(instr));
+			if (field0(instr) != field1(instr) && blockPtr->end + 1 < numMemory)
+			{
+				blockPtr->succ[blockPtr->numSucc++] = blockOf[blockPtr->end + 1];
+				blockPtr->branch = 1;
+			}
+			if (target >= 0 && target < numMemory)
+				blockPtr->succ[blockPtr->numSucc++] = blockOf[target];
+		}
+		else if (blockPtr->end + 1 < numMemory)
+			blockPtr->succ[blockPtr->numSucc++] = blockOf[blockPtr->end + 1];
+	}
+}
+
+void
+meetRegs(regsType *into, regsType *from)
+{
+	for (int r = 0; r < NUMREGS; r++)
+	{
+		if (from->kind[r] == UNKNOWN || into->kind[r] == VARIES)
+			continue;
+		if (into->kind[r] == UNKNOWN)
+		{
+			into->kind[r] = from->kind[r];
+			into->value[r] = from->value[r];
+		}
+		else if (from->kind[r] == VARIES || from->value[r] != into->value[r])
+			into->kind[r] = VARIES;
+	}
+}
+
+/* apply one instruction to the register facts */
+void
+transfer(regsType *regs, int addr)
+{
+	int instr = mem[addr];
+	int op = opcode(instr);
+	int a = field0(instr), b = field1(instr), d = field2(instr) & 0x7;
+	int kind, value = 0, target;
+
+	if (op == ADD || op == NOR)
+	{
+		if (regs->kind[a] == VARIES || regs->kind[b] == VARIES)
+			kind = VARIES;
+		else if (regs->kind[a] == CONSTANT && regs->kind[b] == CONSTANT)
+		{
+			kind = CONSTANT;
+			value = op == ADD ? regs->value[a] + regs->value[b] : ~(regs->value[a] | regs->value[b]);
+		}
+		else
+			kind = UNKNOWN;
+		regs->kind[d] = kind;
+		regs->value[d] = value;
+	}
+	else if (op == LW)
+	{
+		target = regs->value[a] + getOffset(field2(instr));
+		if (regs->kind[a] == UNKNOWN)
+			regs->kind[b] = UNKNOWN;
+		else if (regs->kind[a] == CONSTANT && target >= 0 && target < numMemory && constMem[target])
+		{
+			regs->kind[b] = CONSTANT;
+			regs->value[b] = mem[target];
+		}
+		else
+			regs->kind[b] = VARIES;
+	}
+	else if (op == SWAP)
+		regs->kind[b] = VARIES;
+}
+
+/*
+ * Clear constMem for the words the sw or swap at addr may write, given the
+ * register facts in front of it; return 1 if any word lost its mark. Only
+ * a base register that takes several values could write anywhere.
+ */
+int
+killStore(regsType *regs, int addr)
+{
+	int a = field0(mem[addr]);
+	int target = regs->value[a] + getOffset(field2(mem[addr]));
+	int killed = 0;
+
+	if (regs->kind[a] == UNKNOWN)
+		return 0;
+	if (regs->kind[a] == CONSTANT)
+	{
+		if (target < 0 || target >= numMemory || !constMem[target])
+			return 0;
+		constMem[target] = 0;
+		return 1;
+	}
+	for (int i = 0; i < numMemory; i++)
+	{
+		killed |= constMem[i];
+		constMem[i] = 0;
+	}
+	return killed;
+}
+
+/*
+ * Forward constant propagation over registers. A word counts as constant
+ * memory (a .fill the program only reads) until a sw or swap is found
+ * that could write it. Store targets come from the register facts
+ * themselves, so constMem is worked out in the same fixpoint: it starts
+ * out all set, and a word that loses its mark turns the loads of it from
+ * CONSTANT to VARIES, which the next round passes on.
+ */
+void
+propagateConstants(void)
+{
+	regsType regs;
+	int changed, op;
+
+	for (int i = 0; i < numMemory; i++)
+		constMem[i] = 1;
+
+	for (int r = 0; r < NUMREGS; r++)
+		blocks[0].in.kind[r] = CONSTANT;
+	do {
+		changed = 0;
+		for (int b = 0; b < numBlocks; b++)
+		{
+			regs = blocks[b].in;
+			for (int i = blocks[b].start; i <= blocks[b].end; i++)
+			{
+				op = opcode(mem[i]);
+				if ((op == SW || op == SWAP) && killStore(&regs, i))
+					changed = 1;
+				transfer(&regs, i);
+			}
+			for (int s = 0; s < blocks[b].numSucc; s++)
+			{
+				regsType *in = &blocks[blocks[b].succ[s]].in;
+				regsType old = *in;
+				meetRegs(in, &regs);
+				if (memcmp(&old, in, sizeof(regsType)))
+					changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+#define DOMINATES(a, b) (dom[b][(a) / 8] & (1 << ((a) % 8)))
+
+void
+findDominators(void)
+{
+	int changed;
+	unsigned char meet[MAXBLOCKS / 8];
+	int bytes = (numBlocks + 7) / 8;
+	int first;
+
+	memset(dom[0], 0, bytes);
+	dom[0][0] = 1;
+	for (int b = 1; b < numBlocks; b++)
+		memset(dom[b], 0xff, bytes);
+
+	do {
+		changed = 0;
+		for (int b = 1; b < numBlocks; b++)
+		{
+			first = 1;
+			for (int p = 0; p < numBlocks; p++)
+			{
+				for (int s = 0; s < blocks[p].numSucc; s++)
+				{
+					if (blocks[p].succ[s] != b)
+						continue;
+					if (first)
+						memcpy(meet, dom[p], bytes);
+					else
+					{
+						for (int i = 0; i < bytes; i++)
+							meet[i] &= dom[p][i];
+					}
+					first = 0;
+				}
+			}
+			if (first)
+				memset(meet, 0, bytes); /* only reachable through jalr */
+			meet[b / 8] |= 1 << (b % 8);
+			if (memcmp(meet, dom[b], bytes))
+			{
+				memcpy(dom[b], meet, bytes);
+				changed = 1;
+			}
+		}
+	} while (changed);
+}
+
+/* natural loops of the back edges, one loop per header */
+void
+findLoops(void)
+{
+	static int stack[MAXBLOCKS];
+	int top, n, h, l;
+
+	for (int t = 0; t < numBlocks; t++)
+	{
+		for (int s = 0; s < blocks[t].numSucc; s++)
+		{
+			h = blocks[t].succ[s];
+			if (!DOMINATES(h, t))
+				continue;
+			for (l = 0; l < numLoops && loops[l].header != h; l++)
+				;
+			if (l == numLoops)
+			{
+				if (numLoops == MAXLOOPS)
+				{
+					printf("error: more than %d loops\n", MAXLOOPS);
+					exit(1);
+				}
+				numLoops++;
+				memset(&loops[l], 0, sizeof(loopType));
+				loops[l].header = h;
+				loops[l].body[h] = 1;
+				loops[l].test = -1;
+			}
+			/* everything that reaches the back edge without passing the header */
+			top = 0;
+			if (!loops[l].body[t])
+			{
+				loops[l].body[t] = 1;
+				stack[top++] = t;
+			}
+			while (top > 0)
+			{
+				n = stack[--top];
+				for (int p = 0; p < numBlocks; p++)
+				{
+					for (int ps = 0; ps < blocks[p].numSucc; ps++)
+					{
+						if (blocks[p].succ[ps] == n && !loops[l].body[p])
+						{
+							loops[l].body[p] = 1;
+							stack[top++] = p;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	for (l = 0; l < numLoops; l++)
+	{
+		for (int b = 0; b < numBlocks; b++)
+			loops[l].size += loops[l].body[b];
+	}
+	for (l = 0; l < numLoops; l++)
+	{
+		loops[l].parent = -1;
+		for (int o = 0; o < numLoops; o++)
+		{
+			if (o != l && loops[o].body[loops[l].header] && loops[o].size > loops[l].size &&
+				(loops[l].parent < 0 || loops[o].size < loops[loops[l].parent].size))
+				loops[l].parent = o;
+		}
+	}
+	for (l = 0; l < numLoops; l++)
+	{
+		for (int p = loops[l].parent; p >= 0; p = loops[p].parent)
+			loops[l].depth++;
+		loops[l].depth++;
+	}
+}
+
+/*
+ * Work out how often each loop's exit test runs. This handles the usual
+ * counted loop: `beq i n exit` with n constant, i set to a constant before
+ * the loop, and a single `add i k i` in the body with k constant.
+ */
+void
+findTripCounts(void)
+{
+	loopType *loopPtr;
+	regsType regs, entry;
+	int instr, r, other, defs, incr, pre, span;
+
+	for (int l = 0; l < numLoops; l++)
+	{
+		loopPtr = &loops[l];
+		loopPtr->trips = DEFAULTTRIPS;
+
+		/* the first conditional beq whose taken edge leaves the loop */
+		for (int b = 0; b < numBlocks && loopPtr->test < 0; b++)
+		{
+			if (loopPtr->body[b] && blocks[b].branch && !loopPtr->body[blocks[b].succ[1]] &&
+				loopPtr->body[blocks[b].succ[0]])
+				loopPtr->test = b;
+		}
+		if (loopPtr->test < 0)
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+		for (int p = 0; p < numBlocks; p++)
+		{
+			if (loopPtr->body[p])
+				continue;
+			for (int s = 0; s < blocks[p].numSucc; s++)
+			{
+				if (blocks[p].succ[s] != loopPtr->header)
+					continue;
+				regs = blocks[p].in;
+				for (int i = blocks[p].start; i <= blocks[p].end; i++)
+					transfer(&regs, i);
+				meetRegs(&entry, &regs);
+			}
+		}
+
+		instr = mem[blocks[loopPtr->test].end];
+		for (int side = 0; side < 2 && !loopPtr->known; side++)
+		{
+			r = side ? field1(instr) : field0(instr);
+			other = side ? field0(instr) : field1(instr);
+			if (blocks[loopPtr->test].in.kind[other] != CONSTANT || entry.kind[r] != CONSTANT)
+				continue;
+
+			/* exactly one definition of r in the loop, and it is r += k */
+			defs = 0;
+			incr = -1;
+			for (int b = 0; b < numBlocks; b++)
+			{
+				if (!loopPtr->body[b])
+					continue;
+				regs = blocks[b].in;
+				for (int i = blocks[b].start; i <= blocks[b].end; i++)
+				{
+					int op = opcode(mem[i]);
+					int a = field0(mem[i]), c = field1(mem[i]), d = field2(mem[i]) & 0x7;
+					if ((op == ADD || op == NOR) && d == r)
+					{
+						defs++;
+						if (op == ADD && a == r && c != r && regs.kind[c] == CONSTANT)
+							incr = i, loopPtr->step = regs.value[c];
+						else if (op == ADD && c == r && a != r && regs.kind[a] == CONSTANT)
+							incr = i, loopPtr->step = regs.value[a];
+					}
+					else if ((op == LW || op == SWAP) && c == r)
+						defs++;
+					transfer(&regs, i);
+				}
+			}
+			if (defs != 1 || incr < 0 || loopPtr->step == 0)
+				continue;
+
+			/* does the increment run before the test within an iteration? */
+			pre = blockOf[incr] == loopPtr->test ? incr < blocks[loopPtr->test].end :
+				DOMINATES(blockOf[incr], loopPtr->test) != 0;
+			loopPtr->reg = r;
+			loopPtr->init = entry.value[r];
+			loopPtr->bound = blocks[loopPtr->test].in.value[other];
+			span = loopPtr->bound - loopPtr->init - pre * loopPtr->step;
+			if (span % loopPtr->step != 0 || span / loopPtr->step < 0)
+				continue;
+			loopPtr->trips = span / loopPtr->step + 1;
+			loopPtr->known = 1;
+		}
+	}
+}
+
+/*
+ * Estimate block frequencies and cycle costs. Within a loop, blocks that
+ * dominate the exit test run once per test and the rest once per test
+ * minus one; nesting multiplies. Other conditional branches are taken
+ * half the time, and both of their successors are charged in full.
+ */
+void
+estimate(void)
+{
+	blockType *blockPtr;
+	loopType *loopPtr;
+	double entries, notTaken;
+	int next;
+
+	for (int b = 0; b < numBlocks; b++)
+	{
+		blocks[b].freq = 1;
+		for (int l = 0; l < numLoops; l++)
+		{
+			loopPtr = &loops[l];
+			if (!loopPtr->body[b])
+				continue;
+			if (loopPtr->test < 0 || DOMINATES(b, loopPtr->test))
+				blocks[b].freq *= loopPtr->trips;
+			else
+				blocks[b].freq *= loopPtr->trips - 1;
+		}
+	}
+
+	for (int b = 0; b < numBlocks; b++)
+	{
+		blockPtr = &blocks[b];
+		if (opcode(mem[blockPtr->end]) == BEQ)
+		{
+			if (!blockPtr->branch)
+				blockPtr->taken = blockPtr->freq;
+			else
+			{
+				blockPtr->taken = blockPtr->freq / 2;
+				for (int l = 0; l < numLoops; l++)
+				{
+					if (loops[l].test == b)
+					{
+						entries = blocks[loops[l].header].freq / loops[l].trips;
+						blockPtr->taken = entries;
+					}
+				}
+			}
+		}
+		notTaken = blockPtr->freq - blockPtr->taken;
+
+		for (int i = blockPtr->start; i < blockPtr->end; i++)
+		{
+			if (isDataHazard(mem[i + 1], mem[i]))
+				blockPtr->stalls += blockPtr->freq;
+		}
+		next = blockPtr->end + 1;
+		if (next < numMemory && reached[next] && notTaken > 0 && opcode(mem[blockPtr->end]) != HALT &&
+			isDataHazard(mem[next], mem[blockPtr->end]))
+			blockPtr->stalls += notTaken;
+	}
+
+	for (int l = 0; l < numLoops; l++)
+	{
+		for (int b = 0; b < numBlocks; b++)
+		{
+			if (!loops[l].body[b])
+				continue;
+			blockPtr = &blocks[b];
+			loops[l].cycles += blockPtr->freq * (blockPtr->end - blockPtr->start + 1) +
+				blockPtr->stalls + BRANCHPENALTY * blockPtr->taken;
+		}
+	}
+}
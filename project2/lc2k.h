@@ -0,0 +1,85 @@
+/*
+ * LC-2K instruction encoding shared by simulate.c and analyze.c: opcode
+ * and field macros, offset sign extension, the load-use hazard check and
+ * the disassembler both programs print latches and listings with.
+ */
+#ifndef LC2K_H
+#define LC2K_H
+
+#include <stdio.h>
+
+#define NUMMEMORY 65536 /* maximum number of data words in memory */
+#define NUMREGS 8 /* number of machine registers */
+
+#define ADD 0
+#define NOR 1
+#define LW 2
+#define SW 3
+#define BEQ 4
+#define JALR 5 /* JALR will not implemented for this project */
+#define HALT 6
+#define NOOP 7
+#define SWAP 8 /* extension: ADD with the lowest unused bit set */
+
+#define NOOPINSTR 0x1c00000
+#define field0(i) ((i>>19)&0x7)
+#define field1(i) ((i>>16)&0x7)
+#define field2(i) (i&0xFFFF)
+#define opcode(i) (i>>22)
+
+static int
+getOffset(int n)
+{
+	if (n & (1 << 15)) {
+		n -= (1 << 16);
+	}
+	return n;
+}
+
+/* does instr1, right behind the load instr2, read the register it loads? */
+static int
+isDataHazard(int instr1, int instr2)
+{
+	int op1 = opcode(instr1);
+	int op2 = opcode(instr2);
+	if (op2 == SWAP)
+		op2 = LW; /* swap loads into regB just like lw */
+	if (op2 == LW && (op1 == ADD || op1 == BEQ || op1 == NOR) && (field0(instr1) == field1(instr2) || field1(instr1) == field1(instr2)))
+		return 1;
+	if (op2 == LW && (op1 == LW || op1 == SW || op1 == SWAP) && (field0(instr1) == field1(instr2)))
+		return 1;
+	return 0;
+}
+
+static const char *
+opcodeName(int instr)
+{
+	if (opcode(instr) == ADD)
+		return "add";
+	else if (opcode(instr) == NOR)
+		return "nor";
+	else if (opcode(instr) == LW)
+		return "lw";
+	else if (opcode(instr) == SW)
+		return "sw";
+	else if (opcode(instr) == BEQ)
+		return "beq";
+	else if (opcode(instr) == JALR)
+		return "jalr";
+	else if (opcode(instr) == HALT)
+		return "halt";
+	else if (opcode(instr) == NOOP)
+		return "noop";
+	else if (opcode(instr) == SWAP)
+		return "swap";
+	return "data";
+}
+
+static void
+printInstruction(int instr)
+{
+	printf("%s %d %d %d\n", opcodeName(instr), field0(instr), field1(instr),
+		field2(instr));
+}
+
+#endif /* LC2K_H */
@@ -1,24 +1,14 @@
+#define _POSIX_C_SOURCE 200809L /* pthread barriers, sysconf */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <limits.h>
 
-#define NUMMEMORY 65536 /* maximum number of data words in memory */
-#define NUMREGS 8 /* number of machine registers */
-
-#define ADD 0
-#define NOR 1
-#define LW 2
-#define SW 3
-#define BEQ 4
-#define JALR 5 /* JALR will not implemented for this project */
-#define HALT 6
-#define NOOP 7
-
-#define NOOPINSTR 0x1c00000
-#define filed0(i) ((i>>19)&0x7)
-#define filed1(i) ((i>>16)&0x7)
-#define filed2(i) (i&0xFFFF)
-#define opcode(i) (i>>22)
+#include "lc2k.h"
 
 typedef struct IFIDStruct {
 	int instr;
@@ -50,10 +40,21 @@ typedef struct WBENDStruct {
 	int writeData;
 } WBENDType;
 
+/* the fields a cycle changes; stateType starts with the same ones */
+typedef struct pipelineStruct {
+	int pc;
+	int reg[NUMREGS];
+	int numMemory;
+	IFIDType IFID;
+	IDEXType IDEX;
+	EXMEMType EXMEM;
+	MEMWBType MEMWB;
+	WBENDType WBEND;
+	int cycles;
+} pipelineType;
+
 typedef struct stateStruct {
 	int pc;
-	int instrMem[NUMMEMORY];
-	int dataMem[NUMMEMORY];
 	int reg[NUMREGS];
 	int numMemory;
 	IFIDType IFID;
@@ -62,23 +63,244 @@ typedef struct stateStruct {
 	MEMWBType MEMWB;
 	WBENDType WBEND;
 	int cycles; /* number of cycles run so far */
+	/* memories go last so a cycle only has to copy the fields above */
+	int instrMem[NUMMEMORY];
+	int dataMem[NUMMEMORY];
 } stateType;
 
-int getOffset(int n);
-int isDataHazard(int instr1, int instr2);
+#define PIPELINESIZE sizeof(pipelineType)
+
+_Static_assert(offsetof(stateType, cycles) == offsetof(pipelineType, cycles) &&
+	offsetof(stateType, instrMem) == PIPELINESIZE,
+	"stateType must start with the fields of pipelineType");
+
+#define MAXLABELS 1024
+#define MAXLABELLENGTH 100
+#define MAXWATCHES 16
+#define SNAPINTERVAL 1024 /* cycles between reverse-step snapshots */
+#define NUMSNAPS 16
+
+/*
+ * The instrMem address each latch's instruction was fetched from, or -1
+ * for a bubble. The latches themselves can't tell: a bubble and a noop in
+ * the program are the same word, and a squashed fetch looks like any other.
+ */
+typedef struct traceStruct {
+	int IFID;
+	int IDEX;
+	int EXMEM;
+	int MEMWB;
+	int WBEND;
+} traceType;
+
+typedef struct debugStruct {
+	unsigned char breakMap[NUMMEMORY]; /* nonzero where a breakpoint is set */
+	int watchAddr[MAXWATCHES];
+	int watchValue[MAXWATCHES];
+	int numWatches;
+	int watchRegs[NUMREGS];
+	int watchRegValue[NUMREGS];
+	int numWatchRegs;
+	struct {
+		char label[MAXLABELLENGTH];
+		int addr;
+	} labels[MAXLABELS];
+	int numLabels;
+	stateType *initial; /* state before the first cycle */
+	stateType *snaps; /* ring of periodic snapshots */
+	int snapCycle[NUMSNAPS];
+	traceType trace;
+	traceType snapTraces[NUMSNAPS];
+} debugType;
+
+#define MAXCORES 64
+#define QUANTUM 1000 /* longest window the cores run ahead on their own */
+#define MINQUANTUM 16 /* shortest, after windows keep getting undone */
+#define L1SETS 16
+#define L1WAYS 2
+#define L1BLOCKWORDS 4
+#define MEMLATENCY 10 /* stall cycles for an L1 miss served by memory */
+#define TRANSFERLATENCY 4 /* for a miss served by another core's cache */
+#define UPGRADELATENCY 2 /* for a write that hits a SHARED line */
+
+/* MESI line states */
+#define INVALID 0
+#define SHARED 1
+#define EXCLUSIVE 2
+#define MODIFIED 3
+
+typedef struct lineStruct {
+	int tag;
+	int state;
+	long lastUse; /* for LRU replacement */
+} lineType;
+
+typedef struct coreStruct {
+	stateType *state; /* private pipeline; dataMem only stages shared words */
+	lineType l1[L1SETS][L1WAYS];
+	lineType ahead[L1SETS][L1WAYS]; /* the core's view of l1 while running ahead */
+	long clock; /* ticks once per cache access, orders LRU */
+	int fault; /* cycle of an out-of-range access while running ahead, or -1 */
+	long instructions; /* instructions that reached WBEND */
+	long loads;
+	long stores;
+	long swaps;
+	long hits;
+	long misses;
+	long upgrades; /* writes that hit a SHARED line */
+	int stall; /* cycles until the L1 has served the last access */
+	long stallCycles;
+} coreType;
+
+/* one dataMem access made while a core ran ahead */
+typedef struct accessStruct {
+	int cycle;
+	int addr;
+	int op;
+	int latency;
+	int readValue; /* the word as the core saw it */
+	int writeValue;
+} accessType;
+
+typedef struct logStruct {
+	accessType *accesses;
+	int size;
+	int capacity;
+	int *written; /* window in which the core last stored to each word */
+} logType;
+
+typedef struct statsStruct {
+	long busRd;
+	long busRdX;
+	long busUpgr;
+	long writebacks;
+	long transfers; /* misses served by another core's cache */
+	long invalidations;
+} statsType;
+
+typedef struct systemStruct {
+	int numCores;
+	int numThreads;
+	coreType cores[MAXCORES];
+	int dataMem[NUMMEMORY]; /* shared by all cores */
+	int window; /* number of the current window */
+	int windowEnd; /* no core runs past this cycle in the current window */
+	int done;
+	pthread_barrier_t start;
+	pthread_barrier_t finish;
+	logType logs[MAXCORES];
+	/* what undoing the current window restores */
+	coreType saved[MAXCORES];
+	char savedPipelines[MAXCORES][PIPELINESIZE];
+	statsType savedStats;
+	int *undo; /* address and old value of each word the replay stored */
+	int undoSize;
+	int undoCapacity;
+	statsType stats;
+	long windows; /* windows kept */
+	long rollbacks; /* windows undone and rerun serially */
+} systemType;
+
+#define BATCHCYCLES 256 /* cycles a formatter thread turns into text at a time */
+#define NUMBATCHES 32 /* batches in flight between the simulation and the writer */
+#define MAXFORMATTERS 16
+
+/* room formatState() may need for a machine with n words of memory */
+#define STATETEXTSIZE(n) (((n) + 40) * 40)
+
+/* everything a formatter needs to reproduce one printState() */
+typedef struct recordStruct {
+	char pipeline[PIPELINESIZE];
+	int storeAddr; /* dataMem word written in the cycle, or -1 */
+	int storeValue;
+} recordType;
+
+/* a run of consecutive cycles on its way from the simulation to stdout */
+typedef struct batchStruct {
+	recordType records[BATCHCYCLES];
+	int numRecords;
+	int halted; /* the last record is the halted machine */
+	int *dataMem; /* dataMem before the first record */
+	char *text;
+	long textLength;
+	long textCapacity;
+	_Atomic long filled; /* number of the batch in this slot plus one, once filled */
+	_Atomic long formatted; /* likewise, once turned into text */
+} batchType;
+
+/* batches are numbered in cycle order and live in slot number % NUMBATCHES */
+typedef struct ringStruct {
+	batchType batches[NUMBATCHES];
+	int numMemory;
+	_Atomic long claimed; /* next batch a formatter takes */
+	_Atomic long written; /* batches the writer has written out */
+	_Atomic long numBatches; /* all of them, once the machine has halted */
+	/* threads that find their batch or slot not ready yet sleep on these */
+	pthread_mutex_t lock;
+	pthread_cond_t filledCond;
+	pthread_cond_t formattedCond;
+	pthread_cond_t writtenCond;
+} ringType;
+
+#define OUTBUFSIZE (1 << 20)
+
+/* structured output is collected here and written out in large chunks */
+char outBuf[OUTBUFSIZE];
+int outLen;
+
+char *formatInt(char *text, int n);
+char *formatState(char *text, stateType *statePtr);
 void printState(stateType *statePtr);
-void printInstruction(int instr);
+void runCycle(stateType *statePtr);
+int idleCycles(stateType *statePtr);
+int runJson(stateType *statePtr);
+int runCores(stateType *statePtr, int numCores);
+int runPipelined(stateType *statePtr);
+void readLabels(debugType *debugPtr, char *fileName);
+int runDebugger(stateType *statePtr, debugType *debugPtr);
 
 FILE *filePtr;
 
 int main(int argc, char **argv)
 {
 	stateType state;
-	stateType newState;
 	char ch[1001];
+	int debug = 0;
+	int quiet = 0;
+	int json = 0;
+	int numCores = 0;
+	int pipelined = 0;
+	int idle;
+	char *labelFile = NULL;
+	static debugType debugger;
+
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-d"))
+			debug = 1;
+		else if (!strcmp(argv[1], "-q"))
+			quiet = 1;
+		else if (!strcmp(argv[1], "-j"))
+			json = 1;
+		else if (!strcmp(argv[1], "-p"))
+			pipelined = 1;
+		else if (!strcmp(argv[1], "-l") && argc > 3)
+		{
+			labelFile = argv[2];
+			argc--, argv++;
+		}
+		else if (!strcmp(argv[1], "-n") && argc > 3)
+		{
+			numCores = atoi(argv[2]);
+			argc--, argv++;
+		}
+		else
+			break;
+		argc--, argv++;
+	}
 
-  if (argc != 2) {
-    printf("error: usage: %s <machine-code file>\n", argv[0]);
+  if (argc != 2 || numCores < 0 || numCores > MAXCORES) {
+    printf("error: usage: %s [-d] [-q] [-j] [-p] [-n <cores>] [-l <assembly-code file>] <machine-code file>\n", argv[0]);
     exit(1);
   }
   
@@ -120,257 +342,1526 @@ int main(int argc, char **argv)
 			printf("error read memory\n");
 			exit(1);
 		}
-		printf("memory[%d]=%d\n", state.numMemory, state.instrMem[state.numMemory]);
+		if (!json)
+			printf("memory[%d]=%d\n", state.numMemory, state.instrMem[state.numMemory]);
 		state.dataMem[state.numMemory] = state.instrMem[state.numMemory];
 		state.numMemory++;
 	}
 
-	newState.pc = 0;
-	for (int i = 0; i < NUMREGS; i++)
-		newState.reg[i] = 0;
+	if (debug)
+	{
+		if (labelFile != NULL)
+			readLabels(&debugger, labelFile);
+		return runDebugger(&state, &debugger);
+	}
 
-	newState.cycles = 0;
+	if (json)
+		return runJson(&state);
 
-	newState.IFID.instr = NOOPINSTR;
-	newState.IDEX.instr = NOOPINSTR;
-	newState.EXMEM.instr = NOOPINSTR;
-	newState.MEMWB.instr = NOOPINSTR;
-	newState.WBEND.instr = NOOPINSTR;
+	if (numCores > 0)
+		return runCores(&state, numCores);
 
-	int op;
+	if (pipelined && !quiet)
+		return runPipelined(&state);
 
 	while (1)
 	{
-		printState(&state);
+		if (!quiet)
+			printState(&state);
 
 		/* check for halt */
 		if (opcode(state.MEMWB.instr) == HALT) {
+			if (quiet)
+				printState(&state);
 			printf("machine halted\n");
 			printf("total of %d cycles executed\n", state.cycles);
 			exit(0);
 		}
 
-		newState = state;
-		newState.cycles++;
-
-		/* --------------------- IF stage --------------------- */
-		if (!isDataHazard(state.IFID.instr, state.IDEX.instr))
+		/* nobody looks at the skipped states, so jump over idle stretches */
+		if (quiet && (idle = idleCycles(&state)) > 0)
 		{
-			newState.IFID.instr = state.instrMem[state.pc];
-			newState.pc = state.pc + 1;
-			newState.IFID.pcPlus1 = newState.pc;
+			state.pc += idle;
+			state.IFID.pcPlus1 += idle;
+			state.IDEX.pcPlus1 += idle;
+			state.EXMEM.branchTarget += idle;
+			state.cycles += idle;
 		}
-		
 
-		/* --------------------- ID stage --------------------- */
+		runCycle(&state);
+	}
+}
+
+/*
+ * Number of upcoming cycles that would only shift noops through the
+ * pipeline. That is the case when every latch holds a noop fetched in
+ * sequence (so each latch differs from the one before only by its pc) and
+ * the next instructions to fetch are noops as well; each such cycle just
+ * advances the fetch pc and the pc copies in the latches by one.
+ */
+int idleCycles(stateType *statePtr)
+{
+	int n;
+
+	if (statePtr->IFID.instr != NOOPINSTR || statePtr->IDEX.instr != NOOPINSTR ||
+		statePtr->EXMEM.instr != NOOPINSTR || statePtr->MEMWB.instr != NOOPINSTR ||
+		statePtr->WBEND.instr != NOOPINSTR)
+		return 0;
+	if (statePtr->IFID.pcPlus1 != statePtr->pc ||
+		statePtr->IDEX.pcPlus1 != statePtr->pc - 1 ||
+		statePtr->IDEX.offset != 0 ||
+		statePtr->IDEX.readRegA != statePtr->reg[0] ||
+		statePtr->IDEX.readRegB != statePtr->reg[0] ||
+		statePtr->EXMEM.branchTarget != statePtr->pc - 2 ||
+		statePtr->EXMEM.readRegB != statePtr->reg[0] ||
+		statePtr->WBEND.writeData != 0)
+		return 0;
+
+	for (n = 0; statePtr->pc + n < NUMMEMORY && statePtr->instrMem[statePtr->pc + n] == NOOPINSTR; n++)
+		;
+	return n;
+}
+
+/* advance *statePtr by one clock cycle */
+void runCycle(stateType *statePtr)
+{
+	pipelineType newState;
+	int op;
+
+	memcpy(&newState, statePtr, PIPELINESIZE);
+	newState.cycles++;
+
+	/* --------------------- IF stage --------------------- */
+	if (!isDataHazard(statePtr->IFID.instr, statePtr->IDEX.instr))
+	{
+		newState.IFID.instr = statePtr->instrMem[statePtr->pc];
+		newState.pc = statePtr->pc + 1;
+		newState.IFID.pcPlus1 = newState.pc;
+	}
+	
+
+	/* --------------------- ID stage --------------------- */
+
+
+	if (isDataHazard(statePtr->IFID.instr, statePtr->IDEX.instr)) 
+	{
+		newState.IDEX.instr = NOOPINSTR;
+		newState.IDEX.pcPlus1 = 0;
+		newState.IDEX.readRegA = 0;
+		newState.IDEX.readRegB = 0;
+		newState.IDEX.offset = 0;
+	}
+	else 
+	{
+		newState.IDEX.instr = statePtr->IFID.instr;
+		newState.IDEX.pcPlus1 = statePtr->IFID.pcPlus1;
+		newState.IDEX.readRegA = statePtr->reg[field0(statePtr->IFID.instr)];
+		newState.IDEX.readRegB = statePtr->reg[field1(statePtr->IFID.instr)];
+		newState.IDEX.offset = getOffset(field2(statePtr->IFID.instr));
+	}
+
+	/* --------------------- EX stage --------------------- */
+	
+	newState.EXMEM.instr = statePtr->IDEX.instr;
+	newState.EXMEM.branchTarget = statePtr->IDEX.pcPlus1 + statePtr->IDEX.offset;
+	newState.EXMEM.readRegB = statePtr->IDEX.readRegB;
 
+	op = opcode(newState.EXMEM.instr);
+	if (op == ADD)
+		newState.EXMEM.aluResult = statePtr->IDEX.readRegA + statePtr->IDEX.readRegB;
+	else if (op == NOR)
+		newState.EXMEM.aluResult = ~(statePtr->IDEX.readRegA | statePtr->IDEX.readRegB);
+	else if (op == LW || op == SW || op == SWAP)
+		newState.EXMEM.aluResult = statePtr->IDEX.readRegA + statePtr->IDEX.offset;
+	else if (op == BEQ)
+		newState.EXMEM.aluResult = statePtr->IDEX.readRegA - statePtr->IDEX.readRegB;
 
-		if (isDataHazard(state.IFID.instr, state.IDEX.instr)) 
+	if (op == ADD || op == NOR) 
+	{
+		if (field0(newState.IDEX.instr) == field2(newState.EXMEM.instr))
+			newState.IDEX.readRegA = newState.EXMEM.aluResult;
+		if (field1(newState.IDEX.instr) == field2(newState.EXMEM.instr))
+			newState.IDEX.readRegB = newState.EXMEM.aluResult;
+	}
+
+
+	/* --------------------- MEM stage --------------------- */
+	newState.MEMWB.instr = statePtr->EXMEM.instr;
+	op = opcode(newState.MEMWB.instr);
+	if (op == ADD || op == NOR)
+		newState.MEMWB.writeData = statePtr->EXMEM.aluResult;
+	else if (op == LW || op == SWAP)
+	{
+		newState.MEMWB.writeData = statePtr->dataMem[statePtr->EXMEM.aluResult];
+		if (op == SWAP)
+			statePtr->dataMem[statePtr->EXMEM.aluResult] = statePtr->EXMEM.readRegB;
+		//forwarding
+		int op1 = opcode(newState.IDEX.instr);
+		if(op1 != NOOP || op1 != HALT)
+		{
+			if (field0(newState.IDEX.instr) == field1(newState.MEMWB.instr))
+				newState.IDEX.readRegA = newState.MEMWB.writeData;
+			if (field1(newState.IDEX.instr) == field1(newState.MEMWB.instr))
+				newState.IDEX.readRegB = newState.MEMWB.writeData;
+		}
+		int op2 = opcode(newState.EXMEM.instr);
+		if (op2 == SW || op2 == SWAP)
+		{
+			if (field1(newState.EXMEM.instr) == field1(newState.MEMWB.instr))
+				newState.EXMEM.readRegB = newState.MEMWB.writeData;
+		}
+	}
+	else if (op == SW)
+	{
+		newState.MEMWB.writeData = statePtr->EXMEM.readRegB;
+		/* nothing else touches dataMem this cycle, so store in place */
+		statePtr->dataMem[statePtr->EXMEM.aluResult] = newState.MEMWB.writeData;
+	}
+	else if (op == BEQ)
+	{
+		if (statePtr->EXMEM.aluResult == 0) 
 		{
+			newState.pc = statePtr->EXMEM.branchTarget;
+			newState.IFID.instr = NOOPINSTR;
 			newState.IDEX.instr = NOOPINSTR;
-			newState.IDEX.pcPlus1 = 0;
-			newState.IDEX.readRegA = 0;
-			newState.IDEX.readRegB = 0;
-			newState.IDEX.offset = 0;
-		}
-		else 
-		{
-			newState.IDEX.instr = state.IFID.instr;
-			newState.IDEX.pcPlus1 = state.IFID.pcPlus1;
-			newState.IDEX.readRegA = state.reg[field0(state.IFID.instr)];
-			newState.IDEX.readRegB = state.reg[field1(state.IFID.instr)];
-			newState.IDEX.offset = getOffset(field2(state.IFID.instr));
-		}
-
-		/* --------------------- EX stage --------------------- */
-		
-		newState.EXMEM.instr = state.IDEX.instr;
-		newState.EXMEM.branchTarget = state.IDEX.pcPlus1 + state.IDEX.offset;
-		newState.EXMEM.readRegB = state.IDEX.readRegB;
-
-		op = opcode(newState.EXMEM.instr);
-		if (op == ADD)
-			newState.EXMEM.aluResult = state.IDEX.readRegA + state.IDEX.readRegB;
-		else if (op == NOR)
-			newState.EXMEM.aluResult = ~(state.IDEX.readRegA | state.IDEX.readRegB);
-		else if (op == LW || op == SW)
-			newState.EXMEM.aluResult = state.IDEX.readRegA + state.IDEX.offset;
-		else if (op == BEQ)
-			newState.EXMEM.aluResult = state.IDEX.readRegA - state.IDEX.readRegB;
-
-		if (op == ADD || op == NOR) 
-		{
-			if (field0(newState.IDEX.instr) == field2(newState.EXMEM.instr))
-				newState.IDEX.readRegA = newState.EXMEM.aluResult;
-			if (field1(newState.IDEX.instr) == field2(newState.EXMEM.instr))
-				newState.IDEX.readRegB = newState.EXMEM.aluResult;
-		}
-
-
-		/* --------------------- MEM stage --------------------- */
-		newState.MEMWB.instr = state.EXMEM.instr;
-		op = opcode(newState.MEMWB.instr);
-		if (op == ADD || op == NOR)
-			newState.MEMWB.writeData = state.EXMEM.aluResult;
-		else if (op == LW)
-		{
-			newState.MEMWB.writeData = state.dataMem[state.EXMEM.aluResult];
-			//forwarding
-			int op1 = opcode(newState.IDEX.instr);
-			if(op1 != NOOP || op1 != HALT)
+			newState.EXMEM.instr = NOOPINSTR;
+		}
+	}
+
+	/* --------------------- WB stage --------------------- */
+	newState.WBEND.instr = statePtr->MEMWB.instr;
+	op = opcode(newState.WBEND.instr);
+	if (op == ADD || op == NOR)
+	{
+		newState.reg[field2(newState.WBEND.instr)] = statePtr->MEMWB.writeData;
+		newState.WBEND.writeData = statePtr->MEMWB.writeData;
+	}
+	else if (op == LW || op == SWAP)
+	{
+		newState.reg[field1(newState.WBEND.instr)] = statePtr->MEMWB.writeData;
+		newState.WBEND.writeData = statePtr->MEMWB.writeData;
+	}
+
+	newState.WBEND.writeData = 0;
+
+	// forwarding
+	if (op == LW || op == SWAP)
+	{
+		int op1 = opcode(newState.IDEX.instr);
+		if (op1 != NOOP || op1 != HALT)
+		{
+			if (field0(newState.IDEX.instr) == field1(newState.WBEND.instr))
+				newState.IDEX.readRegA = newState.WBEND.writeData;
+			if (field1(newState.IDEX.instr) == field1(newState.WBEND.instr))
+				newState.IDEX.readRegB = newState.WBEND.writeData;
+		}
+	}
+
+	memcpy(statePtr, &newState, PIPELINESIZE);
+}
+
+void
+outFlush(void)
+{
+	fwrite(outBuf, 1, outLen, stdout);
+	outLen = 0;
+}
+
+void
+outString(const char *string)
+{
+	int length = strlen(string);
+	if (outLen + length > OUTBUFSIZE)
+		outFlush();
+	memcpy(outBuf + outLen, string, length);
+	outLen += length;
+}
+
+/* write n in decimal, like %d; return the end of the digits */
+char *
+formatInt(char *text, int n)
+{
+	char digits[10];
+	int numDigits = 0;
+	unsigned int u = n < 0 ? -(unsigned int)n : (unsigned int)n;
+
+	if (n < 0)
+		*text++ = '-';
+	do {
+		digits[numDigits++] = '0' + u % 10;
+	} while (u /= 10);
+	while (numDigits)
+		*text++ = digits[--numDigits];
+	return text;
+}
+
+void
+outInt(int n)
+{
+	if (outLen + 11 > OUTBUFSIZE)
+		outFlush();
+	outLen = formatInt(outBuf + outLen, n) - outBuf;
+}
+
+/* start a `"key":` member inside an object, opening it with `name` if needed */
+void
+outKey(const char *name, int *opened)
+{
+	if (!*opened)
+	{
+		outString(",\"");
+		outString(name);
+		outString("\":{\"");
+		*opened = 1;
+	}
+	else
+		outString(",\"");
+}
+
+void
+outMember(const char *name, int *opened, int key, int value)
+{
+	outKey(name, opened);
+	outInt(key);
+	outString("\":");
+	outInt(value);
+}
+
+void
+outArray(const char *name, int *values, int count)
+{
+	outString(",\"");
+	outString(name);
+	outString("\":[");
+	for (int i = 0; i < count; i++)
+	{
+		if (i)
+			outString(",");
+		outInt(values[i]);
+	}
+	outString("]");
+}
+
+/* latch fields in the order printState() shows them */
+#define NUMLATCHFIELDS 15
+const char *latchNames[NUMLATCHFIELDS] = {
+	"IFID.instr", "IFID.pcPlus1",
+	"IDEX.instr", "IDEX.pcPlus1", "IDEX.readRegA", "IDEX.readRegB", "IDEX.offset",
+	"EXMEM.instr", "EXMEM.branchTarget", "EXMEM.aluResult", "EXMEM.readRegB",
+	"MEMWB.instr", "MEMWB.writeData",
+	"WBEND.instr", "WBEND.writeData"
+};
+
+void
+latchFields(stateType *statePtr, int *fields)
+{
+	fields[0] = statePtr->IFID.instr;
+	fields[1] = statePtr->IFID.pcPlus1;
+	fields[2] = statePtr->IDEX.instr;
+	fields[3] = statePtr->IDEX.pcPlus1;
+	fields[4] = statePtr->IDEX.readRegA;
+	fields[5] = statePtr->IDEX.readRegB;
+	fields[6] = statePtr->IDEX.offset;
+	fields[7] = statePtr->EXMEM.instr;
+	fields[8] = statePtr->EXMEM.branchTarget;
+	fields[9] = statePtr->EXMEM.aluResult;
+	fields[10] = statePtr->EXMEM.readRegB;
+	fields[11] = statePtr->MEMWB.instr;
+	fields[12] = statePtr->MEMWB.writeData;
+	fields[13] = statePtr->WBEND.instr;
+	fields[14] = statePtr->WBEND.writeData;
+}
+
+/* the "latch" object: every field, or only those that differ from oldFields */
+void
+outLatches(int *fields, int *oldFields)
+{
+	int opened = 0;
+
+	for (int i = 0; i < NUMLATCHFIELDS; i++)
+	{
+		if (oldFields == NULL || fields[i] != oldFields[i])
+		{
+			outKey("latch", &opened);
+			outString(latchNames[i]);
+			outString("\":");
+			outInt(fields[i]);
+		}
+	}
+	if (opened)
+		outString("}");
+}
+
+/*
+ * Newline-delimited JSON: one "init" record with the full machine, then one
+ * record per cycle holding only the registers, data memory word and latch
+ * fields that changed, then a "halt" record.
+ */
+int
+runJson(stateType *statePtr)
+{
+	pipelineType oldState;
+	int oldFields[NUMLATCHFIELDS], fields[NUMLATCHFIELDS];
+	int opened;
+
+	latchFields(statePtr, fields);
+	outString("{\"type\":\"init\",\"cycle\":");
+	outInt(statePtr->cycles);
+	outString(",\"pc\":");
+	outInt(statePtr->pc);
+	outArray("reg", statePtr->reg, NUMREGS);
+	outArray("instrMem", statePtr->instrMem, statePtr->numMemory);
+	outArray("dataMem", statePtr->dataMem, statePtr->numMemory);
+	outLatches(fields, NULL);
+	outString("}\n");
+
+	while (opcode(statePtr->MEMWB.instr) != HALT)
+	{
+		memcpy(&oldState, statePtr, PIPELINESIZE);
+		memcpy(oldFields, fields, sizeof(fields));
+		runCycle(statePtr);
+		latchFields(statePtr, fields);
+
+		outString("{\"cycle\":");
+		outInt(statePtr->cycles);
+		outString(",\"pc\":");
+		outInt(statePtr->pc);
+		opened = 0;
+		for (int i = 0; i < NUMREGS; i++)
+		{
+			if (statePtr->reg[i] != oldState.reg[i])
+				outMember("reg", &opened, i, statePtr->reg[i]);
+		}
+		if (opened)
+			outString("}");
+		if (opcode(statePtr->MEMWB.instr) == SW || opcode(statePtr->MEMWB.instr) == SWAP)
+		{
+			opened = 0;
+			outMember("dataMem", &opened, oldState.EXMEM.aluResult, oldState.EXMEM.readRegB);
+			outString("}");
+		}
+		outLatches(fields, oldFields);
+		outString("}\n");
+	}
+
+	outString("{\"type\":\"halt\",\"cycles\":");
+	outInt(statePtr->cycles);
+	outString("}\n");
+	outFlush();
+	return (0);
+}
+
+/* the core's next cycle has its MEM stage read or write dataMem */
+int
+isMemoryCycle(coreType *corePtr)
+{
+	int op = opcode(corePtr->state->EXMEM.instr);
+	return corePtr->stall == 0 && (op == LW || op == SW || op == SWAP);
+}
+
+/* not halted and not yet at the end of the current window */
+int
+coreActive(systemType *systemPtr, int core)
+{
+	stateType *statePtr = systemPtr->cores[core].state;
+	return opcode(statePtr->MEMWB.instr) != HALT && statePtr->cycles < systemPtr->windowEnd;
+}
+
+/*
+ * The L1 blocks, so the whole pipeline waits for it: nothing but the cycle
+ * count changes while it does, and up to `limit` of those cycles can pass
+ * in one step.
+ */
+void
+skipStall(coreType *corePtr, int limit)
+{
+	int n = corePtr->stall < limit ? corePtr->stall : limit;
+
+	corePtr->stall -= n;
+	corePtr->stallCycles += n;
+	corePtr->state->cycles += n;
+}
+
+void
+coreCycle(coreType *corePtr)
+{
+	if (corePtr->stall > 0)
+	{
+		skipStall(corePtr, 1);
+		return;
+	}
+	runCycle(corePtr->state);
+	if (corePtr->state->WBEND.instr != NOOPINSTR)
+		corePtr->instructions++;
+}
+
+/*
+ * Look the block up in the core's L1 and run the MESI snooping protocol
+ * for it; return the cycles the access stalls the pipeline. Caches hold
+ * tags and states only, the words themselves always live in the shared
+ * dataMem.
+ *
+ * A core running ahead uses its private copy of its L1 and sees the other
+ * caches as they were when the window started. It leaves them and the
+ * statistics alone; the replay performs the access for real.
+ */
+int
+cacheAccess(systemType *systemPtr, int core, int addr, int write, int ahead)
+{
+	coreType *corePtr = &systemPtr->cores[core];
+	int block = addr / L1BLOCKWORDS;
+	int set = block % L1SETS;
+	int tag = block / L1SETS;
+	lineType *ways = (ahead ? corePtr->ahead : corePtr->l1)[set];
+	lineType *line = NULL, *other;
+	int shared = 0, transfer = 0;
+
+	corePtr->clock++;
+	for (int way = 0; way < L1WAYS; way++)
+	{
+		if (ways[way].state != INVALID && ways[way].tag == tag)
+			line = &ways[way];
+	}
+
+	if (line != NULL)
+	{
+		if (!ahead)
+			corePtr->hits++;
+		line->lastUse = corePtr->clock;
+		if (!write || line->state == MODIFIED)
+			return 0;
+		if (line->state == EXCLUSIVE)
+		{
+			line->state = MODIFIED;
+			return 0;
+		}
+		/* SHARED: invalidate the other copies before writing */
+		if (!ahead)
+		{
+			corePtr->upgrades++;
+			systemPtr->stats.busUpgr++;
+		}
+	}
+	else if (!ahead)
+	{
+		corePtr->misses++;
+		if (write)
+			systemPtr->stats.busRdX++;
+		else
+			systemPtr->stats.busRd++;
+	}
+
+	/* snoop */
+	for (int c = 0; c < systemPtr->numCores; c++)
+	{
+		if (c == core)
+			continue;
+		for (int way = 0; way < L1WAYS; way++)
+		{
+			other = &systemPtr->cores[c].l1[set][way];
+			if (other->state == INVALID || other->tag != tag)
+				continue;
+			if (line == NULL && (other->state == MODIFIED || other->state == EXCLUSIVE))
+				transfer = 1;
+			shared = 1;
+			if (ahead)
+				continue;
+			if (other->state == MODIFIED)
+				systemPtr->stats.writebacks++;
+			if (write)
+			{
+				other->state = INVALID;
+				systemPtr->stats.invalidations++;
+			}
+			else
+				other->state = SHARED;
+		}
+	}
+
+	if (line != NULL)
+	{
+		/* an upgrade only has to wait for the invalidations */
+		line->state = MODIFIED;
+		return UPGRADELATENCY;
+	}
+
+	/* fill the least recently used way */
+	line = &ways[0];
+	for (int way = 1; way < L1WAYS; way++)
+	{
+		if (ways[way].state == INVALID ||
+			(line->state != INVALID && ways[way].lastUse < line->lastUse))
+			line = &ways[way];
+	}
+	if (line->state == MODIFIED && !ahead)
+		systemPtr->stats.writebacks++;
+	line->tag = tag;
+	line->lastUse = corePtr->clock;
+	line->state = write ? MODIFIED : (shared ? SHARED : EXCLUSIVE);
+	if (!transfer)
+		return MEMLATENCY;
+	if (!ahead)
+		systemPtr->stats.transfers++;
+	return TRANSFERLATENCY;
+}
+
+/*
+ * Run the core's next cycle, whose MEM stage reads or writes dataMem.
+ * Running ahead, the core sees its own stores from this window and
+ * otherwise the shared words as they were when the window started, and
+ * logs the access for the replay. Return 0 if it has to stop running
+ * ahead.
+ */
+int
+memoryCycle(systemType *systemPtr, int core, int ahead)
+{
+	coreType *corePtr = &systemPtr->cores[core];
+	logType *logPtr = &systemPtr->logs[core];
+	stateType *statePtr = corePtr->state;
+	int addr = statePtr->EXMEM.aluResult;
+	int op = opcode(statePtr->EXMEM.instr);
+	int latency;
+	accessType *accessPtr;
+
+	if (addr < 0 || addr >= NUMMEMORY)
+	{
+		/* the address may come from a stale word; let the serial rerun decide */
+		if (ahead)
+		{
+			corePtr->fault = statePtr->cycles;
+			return 0;
+		}
+		printf("error: core %d accessed dataMem[ %d ] in cycle %d\n", core, addr, statePtr->cycles);
+		exit(1);
+	}
+	if (op == LW)
+		corePtr->loads++;
+	else if (op == SW)
+		corePtr->stores++;
+	else
+		corePtr->swaps++;
+	latency = cacheAccess(systemPtr, core, addr, op != LW, ahead);
+
+	if (!ahead)
+	{
+		/* runCycle() only touches dataMem[addr] in this cycle */
+		statePtr->dataMem[addr] = systemPtr->dataMem[addr];
+		coreCycle(corePtr);
+		systemPtr->dataMem[addr] = statePtr->dataMem[addr];
+		corePtr->stall = latency;
+		return 1;
+	}
+
+	if (logPtr->size == logPtr->capacity)
+	{
+		logPtr->capacity = logPtr->capacity ? 2 * logPtr->capacity : 1024;
+		logPtr->accesses = realloc(logPtr->accesses, logPtr->capacity * sizeof(accessType));
+		if (logPtr->accesses == NULL)
+		{
+			printf("error: out of memory for the access log of core %d\n", core);
+			exit(1);
+		}
+	}
+	if (logPtr->written[addr] != systemPtr->window)
+		statePtr->dataMem[addr] = systemPtr->dataMem[addr];
+	accessPtr = &logPtr->accesses[logPtr->size++];
+	accessPtr->cycle = statePtr->cycles;
+	accessPtr->addr = addr;
+	accessPtr->op = op;
+	accessPtr->latency = latency;
+	accessPtr->readValue = statePtr->dataMem[addr];
+	coreCycle(corePtr);
+	accessPtr->writeValue = statePtr->dataMem[addr];
+	if (op != LW)
+		logPtr->written[addr] = systemPtr->window;
+	corePtr->stall = latency;
+	return 1;
+}
+
+/* advance the core by one cycle; return 0 if it has to stop running ahead */
+int
+coreStep(systemType *systemPtr, int core, int ahead)
+{
+	if (isMemoryCycle(&systemPtr->cores[core]))
+		return memoryCycle(systemPtr, core, ahead);
+	coreCycle(&systemPtr->cores[core]);
+	return 1;
+}
+
+/* run the core on its own until the window ends, it halts or it faults */
+void
+runAhead(systemType *systemPtr, int core)
+{
+	coreType *corePtr = &systemPtr->cores[core];
+
+	while (coreActive(systemPtr, core))
+	{
+		if (corePtr->stall > 0)
+			skipStall(corePtr, systemPtr->windowEnd - corePtr->state->cycles);
+		else if (!coreStep(systemPtr, core, 1))
+			break;
+	}
+}
+
+/* host thread: runs cores id, id + numThreads, ... through each window */
+void *
+coreThread(void *arg)
+{
+	systemType *systemPtr = ((void **)arg)[0];
+	int id = (int)(long)((void **)arg)[1];
+
+	while (1)
+	{
+		pthread_barrier_wait(&systemPtr->start);
+		if (systemPtr->done)
+			break;
+		for (int c = id; c < systemPtr->numCores; c += systemPtr->numThreads)
+			runAhead(systemPtr, c);
+		pthread_barrier_wait(&systemPtr->finish);
+	}
+	return NULL;
+}
+
+/* open the next window, remembering everything it may have to undo */
+void
+beginWindow(systemType *systemPtr, int length)
+{
+	coreType *corePtr;
+
+	systemPtr->window++;
+	systemPtr->windowEnd += length;
+	systemPtr->savedStats = systemPtr->stats;
+	systemPtr->undoSize = 0;
+	for (int c = 0; c < systemPtr->numCores; c++)
+	{
+		corePtr = &systemPtr->cores[c];
+		memcpy(corePtr->ahead, corePtr->l1, sizeof(corePtr->l1));
+		corePtr->fault = -1;
+		systemPtr->saved[c] = *corePtr;
+		memcpy(systemPtr->savedPipelines[c], corePtr->state, PIPELINESIZE);
+		systemPtr->logs[c].size = 0;
+	}
+}
+
+/* put the cores, caches and shared memory back to the start of the window */
+void
+undoWindow(systemType *systemPtr)
+{
+	for (int c = 0; c < systemPtr->numCores; c++)
+	{
+		systemPtr->cores[c] = systemPtr->saved[c];
+		memcpy(systemPtr->cores[c].state, systemPtr->savedPipelines[c], PIPELINESIZE);
+	}
+	systemPtr->stats = systemPtr->savedStats;
+	while (systemPtr->undoSize > 0)
+	{
+		systemPtr->undoSize -= 2;
+		systemPtr->dataMem[systemPtr->undo[systemPtr->undoSize]] =
+			systemPtr->undo[systemPtr->undoSize + 1];
+	}
+}
+
+/*
+ * Perform the logged accesses on the shared dataMem and L1s in (cycle,
+ * core) order, the order a serial run uses. Return the first cycle in
+ * which a core loaded a different word or waited a different latency than
+ * it assumed while running ahead, or -1 if the whole window holds. Up to
+ * that cycle every core behaved exactly as it would have serially.
+ */
+int
+replayWindow(systemType *systemPtr)
+{
+	int next[MAXCORES] = { 0 };
+	int limit = -1, best, old;
+	accessType *accessPtr;
+
+	for (int c = 0; c < systemPtr->numCores; c++)
+	{
+		if (systemPtr->cores[c].fault >= 0 && (limit < 0 || systemPtr->cores[c].fault < limit))
+			limit = systemPtr->cores[c].fault;
+		/* replay the LRU stamps the cores used while running ahead */
+		systemPtr->cores[c].clock = systemPtr->saved[c].clock;
+	}
+
+	while (1)
+	{
+		best = -1;
+		for (int c = 0; c < systemPtr->numCores; c++)
+		{
+			if (next[c] < systemPtr->logs[c].size && (best < 0 ||
+				systemPtr->logs[c].accesses[next[c]].cycle < systemPtr->logs[best].accesses[next[best]].cycle))
+				best = c;
+		}
+		if (best < 0)
+			return limit;
+		accessPtr = &systemPtr->logs[best].accesses[next[best]++];
+		if (limit >= 0 && accessPtr->cycle >= limit)
+			return limit;
+
+		old = systemPtr->dataMem[accessPtr->addr];
+		if (cacheAccess(systemPtr, best, accessPtr->addr, accessPtr->op != LW, 0) != accessPtr->latency ||
+			(accessPtr->op != SW && old != accessPtr->readValue))
+			return accessPtr->cycle;
+		if (accessPtr->op == LW)
+			continue;
+		if (systemPtr->undoSize == systemPtr->undoCapacity)
+		{
+			systemPtr->undoCapacity = systemPtr->undoCapacity ? 2 * systemPtr->undoCapacity : 1024;
+			systemPtr->undo = realloc(systemPtr->undo, systemPtr->undoCapacity * sizeof(int));
+			if (systemPtr->undo == NULL)
 			{
-				if (field0(newState.IDEX.instr) == field1(newState.MEMWB.instr))
-					newState.IDEX.readRegA = newState.MEMWB.writeData;
-				if (field1(newState.IDEX.instr) == field1(newState.MEMWB.instr))
-					newState.IDEX.readRegB = newState.MEMWB.writeData;
+				printf("error: out of memory for the undo log\n");
+				exit(1);
 			}
-			int op2 = opcode(newState.EXMEM.instr);
-			if (op2 == SW)
+		}
+		systemPtr->undo[systemPtr->undoSize++] = accessPtr->addr;
+		systemPtr->undo[systemPtr->undoSize++] = old;
+		systemPtr->dataMem[accessPtr->addr] = accessPtr->writeValue;
+	}
+}
+
+/* run the cores in lockstep to the end of the window, one access at a time */
+void
+runSerial(systemType *systemPtr)
+{
+	int active = 1;
+	int skip, cycle = 0;
+
+	/* every running core starts the window at the same cycle */
+	while (active)
+	{
+		/* while all of them wait for their L1s, jump to the first one served */
+		skip = -1;
+		for (int c = 0; c < systemPtr->numCores; c++)
+		{
+			if (coreActive(systemPtr, c) && (skip < 0 || systemPtr->cores[c].stall < skip))
 			{
-				if (field1(newState.EXMEM.instr) == field1(newState.MEMWB.instr))
-					newState.EXMEM.readRegB = newState.MEMWB.writeData;
+				skip = systemPtr->cores[c].stall;
+				cycle = systemPtr->cores[c].state->cycles;
 			}
 		}
-		else if (op == SW)
+		if (skip > 0)
 		{
-			newState.MEMWB.writeData = state.EXMEM.readRegB;
-			newState.dataMem[state.EXMEM.aluResult] = newState.MEMWB.writeData;
+			if (skip > systemPtr->windowEnd - cycle)
+				skip = systemPtr->windowEnd - cycle;
+			for (int c = 0; c < systemPtr->numCores; c++)
+			{
+				if (coreActive(systemPtr, c))
+					skipStall(&systemPtr->cores[c], skip);
+			}
 		}
-		else if (op == BEQ)
+
+		active = 0;
+		for (int c = 0; c < systemPtr->numCores; c++)
 		{
-			if (state.EXMEM.aluResult == 0) 
+			if (coreActive(systemPtr, c))
 			{
-				newState.pc = state.EXMEM.branchTarget;
-				newState.IFID.instr = NOOPINSTR;
-				newState.IDEX.instr = NOOPINSTR;
-				newState.EXMEM.instr = NOOPINSTR;
+				coreStep(systemPtr, c, 0);
+				active = 1;
 			}
 		}
+	}
+}
+
+/*
+ * Run numCores copies of the pipeline against one shared dataMem. Core c
+ * starts with reg[7] = c so SPMD programs can tell the cores apart. The
+ * L1s block: a miss or an upgrade freezes the core's pipeline until it is
+ * served, so the reported cycles include the cost of coherence traffic.
+ *
+ * Time is cut into windows of up to QUANTUM cycles. In each window the
+ * host threads run every core ahead on its own in parallel, memory
+ * accesses included, logging what each access read and how long it
+ * stalled. The main thread then replays the logs in (cycle, core) order
+ * against the real memory and caches. Cores that keep to their own
+ * blocks agree with the replay and the window is kept. When a core loaded
+ * a word another core stored during the window, or another core took its
+ * line away, the window is undone and rerun serially past the cycle that
+ * went wrong, for longer each time that happens in a row. Either way the
+ * result is exactly that of running the cores in lockstep, independent of
+ * host timing.
+ */
+int
+runCores(stateType *statePtr, int numCores)
+{
+	systemType *systemPtr;
+	pthread_t threads[MAXCORES];
+	void *args[MAXCORES][2];
+	int c, start, length, backoff, mismatch;
+	long hostCpus;
+
+	systemPtr = calloc(1, sizeof(systemType));
+	if (systemPtr == NULL)
+	{
+		printf("error: out of memory for %d cores\n", numCores);
+		exit(1);
+	}
+	systemPtr->numCores = numCores;
+	hostCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	systemPtr->numThreads = hostCpus > 0 && hostCpus < numCores ? hostCpus : numCores;
+	memcpy(systemPtr->dataMem, statePtr->dataMem, statePtr->numMemory * sizeof(int));
+	for (c = 0; c < numCores; c++)
+	{
+		systemPtr->cores[c].state = malloc(sizeof(stateType));
+		systemPtr->logs[c].written = calloc(NUMMEMORY, sizeof(int));
+		if (systemPtr->cores[c].state == NULL || systemPtr->logs[c].written == NULL)
+		{
+			printf("error: out of memory for %d cores\n", numCores);
+			exit(1);
+		}
+		*systemPtr->cores[c].state = *statePtr;
+		systemPtr->cores[c].state->reg[7] = c;
+	}
+
+	pthread_barrier_init(&systemPtr->start, NULL, systemPtr->numThreads);
+	pthread_barrier_init(&systemPtr->finish, NULL, systemPtr->numThreads);
+	for (int t = 1; t < systemPtr->numThreads; t++)
+	{
+		args[t][0] = systemPtr;
+		args[t][1] = (void *)(long)t;
+		pthread_create(&threads[t], NULL, coreThread, args[t]);
+	}
 
-		/* --------------------- WB stage --------------------- */
-		newState.WBEND.instr = state.MEMWB.instr;
-		op = opcode(newState.WBEND.instr);
-		if (op == ADD || op == NOR)
+	length = QUANTUM;
+	backoff = 0;
+	while (1)
+	{
+		for (c = 0; c < numCores; c++)
 		{
-			newState.reg[field2(newState.WBEND.instr)] = state.MEMWB.writeData;
-			newState.WBEND.writeData = state.MEMWB.writeData;
+			if (opcode(systemPtr->cores[c].state->MEMWB.instr) != HALT)
+				break;
 		}
-		else if (op == LW)
+		if (c == numCores)
+			break;
+
+		/* parallel phase; the main thread doubles as thread 0 */
+		start = systemPtr->windowEnd;
+		beginWindow(systemPtr, length);
+		pthread_barrier_wait(&systemPtr->start);
+		for (c = 0; c < numCores; c += systemPtr->numThreads)
+			runAhead(systemPtr, c);
+		pthread_barrier_wait(&systemPtr->finish);
+
+		mismatch = replayWindow(systemPtr);
+		if (mismatch < 0)
 		{
-			newState.reg[field1(newState.WBEND.instr)] = state.MEMWB.writeData;
-			newState.WBEND.writeData = state.MEMWB.writeData;
+			systemPtr->windows++;
+			length = 2 * length < QUANTUM ? 2 * length : QUANTUM;
+			backoff = 0;
+			continue;
 		}
 
-		newState.WBEND.writeData = 0;
+		/* while the cores keep sharing, stay serial for longer each time */
+		undoWindow(systemPtr);
+		systemPtr->rollbacks++;
+		length = length / 2 > MINQUANTUM ? length / 2 : MINQUANTUM;
+		backoff = backoff == 0 ? MINQUANTUM : (2 * backoff < QUANTUM ? 2 * backoff : QUANTUM);
+		systemPtr->windowEnd = mismatch + 1 > start + backoff ? mismatch + 1 : start + backoff;
+		runSerial(systemPtr);
+	}
+
+	systemPtr->done = 1;
+	pthread_barrier_wait(&systemPtr->start);
+	for (int t = 1; t < systemPtr->numThreads; t++)
+		pthread_join(threads[t], NULL);
+
+	for (c = 0; c < numCores; c++)
+	{
+		coreType *corePtr = &systemPtr->cores[c];
+		printf("core %d halted after %d cycles\n", c, corePtr->state->cycles);
+		printf("\tinstructions %ld loads %ld stores %ld swaps %ld\n", corePtr->instructions,
+			corePtr->loads, corePtr->stores, corePtr->swaps);
+		printf("\tL1 hits %ld misses %ld upgrades %ld stall cycles %ld\n", corePtr->hits,
+			corePtr->misses, corePtr->upgrades, corePtr->stallCycles);
+		printf("\tregisters:\n");
+		for (int i = 0; i < NUMREGS; i++)
+			printf("\t\treg[ %d ] %d\n", i, corePtr->state->reg[i]);
+		free(corePtr->state);
+		free(systemPtr->logs[c].accesses);
+		free(systemPtr->logs[c].written);
+	}
+	printf("coherence: BusRd %ld BusRdX %ld BusUpgr %ld writebacks %ld cache-to-cache %ld invalidations %ld\n",
+		systemPtr->stats.busRd, systemPtr->stats.busRdX, systemPtr->stats.busUpgr,
+		systemPtr->stats.writebacks, systemPtr->stats.transfers, systemPtr->stats.invalidations);
+	printf("windows: %ld kept, %ld rerun serially\n", systemPtr->windows, systemPtr->rollbacks);
+	printf("data memory:\n");
+	for (int i = 0; i < statePtr->numMemory; i++)
+		printf("\t\tdataMem[ %d ] %d\n", i, systemPtr->dataMem[i]);
+
+	pthread_barrier_destroy(&systemPtr->start);
+	pthread_barrier_destroy(&systemPtr->finish);
+	free(systemPtr->undo);
+	free(systemPtr);
+	return (0);
+}
+
+/* set *counter to value and wake the threads waiting on cond for it */
+void
+ringPublish(ringType *ringPtr, _Atomic long *counter, long value, pthread_cond_t *cond)
+{
+	pthread_mutex_lock(&ringPtr->lock);
+	atomic_store_explicit(counter, value, memory_order_release);
+	pthread_cond_broadcast(cond);
+	pthread_mutex_unlock(&ringPtr->lock);
+}
+
+/*
+ * Sleep until *counter reaches target; return 0 instead if the machine
+ * halts before there is a batch number `batch`.
+ */
+int
+ringWait(ringType *ringPtr, _Atomic long *counter, long target, long batch, pthread_cond_t *cond)
+{
+	if (atomic_load_explicit(counter, memory_order_acquire) >= target)
+		return 1;
+	pthread_mutex_lock(&ringPtr->lock);
+	while (atomic_load_explicit(counter, memory_order_acquire) < target &&
+		batch < atomic_load(&ringPtr->numBatches))
+		pthread_cond_wait(cond, &ringPtr->lock);
+	pthread_mutex_unlock(&ringPtr->lock);
+	return atomic_load_explicit(counter, memory_order_acquire) >= target;
+}
+
+/* formatter thread: turns one whole batch at a time into text */
+void *
+formatThread(void *arg)
+{
+	ringType *ringPtr = arg;
+	batchType *batchPtr;
+	recordType *recordPtr;
+	stateType *statePtr;
+	long batch, needed;
+	char *text;
+
+	statePtr = malloc(sizeof(stateType));
+	if (statePtr == NULL)
+	{
+		printf("error: out of memory for a formatter\n");
+		exit(1);
+	}
+	while (1)
+	{
+		batch = atomic_fetch_add(&ringPtr->claimed, 1);
+		batchPtr = &ringPtr->batches[batch % NUMBATCHES];
+		if (!ringWait(ringPtr, &batchPtr->filled, batch + 1, batch, &ringPtr->filledCond))
+		{
+			free(statePtr);
+			return NULL;
+		}
 
-		// forwarding
-		if (op == LW)
+		needed = (long)batchPtr->numRecords * STATETEXTSIZE(ringPtr->numMemory) + 100;
+		if (batchPtr->textCapacity < needed)
 		{
-			int op1 = opcode(newState.IDEX.instr);
-			if (op1 != NOOP || op1 != HALT)
+			free(batchPtr->text);
+			batchPtr->textCapacity = needed;
+			if ((batchPtr->text = malloc(needed)) == NULL)
 			{
-				if (field0(newState.IDEX.instr) == field1(newState.WBEND.instr))
-					newState.IDEX.readRegA = newState.WBEND.writeData;
-				if (field1(newState.IDEX.instr) == field1(newState.WBEND.instr))
-					newState.IDEX.readRegB = newState.WBEND.writeData;
+				printf("error: out of memory for the output text\n");
+				exit(1);
 			}
 		}
 
-		state = newState;
+		/* rebuild each cycle's state from the batch's dataMem and the records */
+		memcpy(statePtr->dataMem, batchPtr->dataMem, ringPtr->numMemory * sizeof(int));
+		text = batchPtr->text;
+		for (int i = 0; i < batchPtr->numRecords; i++)
+		{
+			recordPtr = &batchPtr->records[i];
+			memcpy(statePtr, recordPtr->pipeline, PIPELINESIZE);
+			/* words past numMemory are never printed */
+			if (recordPtr->storeAddr >= 0 && recordPtr->storeAddr < ringPtr->numMemory)
+				statePtr->dataMem[recordPtr->storeAddr] = recordPtr->storeValue;
+			text = formatState(text, statePtr);
+		}
+		if (batchPtr->halted)
+		{
+			text += sprintf(text, "machine halted\n");
+			text += sprintf(text, "total of %d cycles executed\n", statePtr->cycles);
+		}
+		batchPtr->textLength = text - batchPtr->text;
+		ringPublish(ringPtr, &batchPtr->formatted, batch + 1, &ringPtr->formattedCond);
 	}
 }
 
-int getOffset(int n) 
+/* writer thread: puts the formatted batches out in cycle order */
+void *
+writeThread(void *arg)
 {
-	if (n & (1 << 15)) {
-		n -= (1 << 16);
+	ringType *ringPtr = arg;
+	batchType *batchPtr;
+
+	for (long batch = 0; ; batch++)
+	{
+		batchPtr = &ringPtr->batches[batch % NUMBATCHES];
+		if (!ringWait(ringPtr, &batchPtr->formatted, batch + 1, batch, &ringPtr->formattedCond))
+			return NULL;
+		fwrite(batchPtr->text, 1, batchPtr->textLength, stdout);
+		ringPublish(ringPtr, &ringPtr->written, batch + 1, &ringPtr->writtenCond);
 	}
-	return n;
 }
 
-int isDataHazard(int instr1, int instr2)
+/*
+ * Same output as the normal loop, but the printState() text, which is
+ * nearly all of the work, is produced by several host threads. The
+ * simulation thread cuts the run into batches of BATCHCYCLES cycles, each
+ * holding the data memory at its start and every cycle's pipeline fields
+ * and stored word. Formatter threads each take a whole batch and rebuild
+ * and format its states into the batch's own text buffer, and a writer
+ * thread writes the buffers out in cycle order. A thread whose batch or
+ * slot isn't ready sleeps until it is, leaving the host CPUs to the ones
+ * with work.
+ */
+int
+runPipelined(stateType *statePtr)
 {
-	int op1 = opcode(instr1);
-	int op2 = opcode(instr2);
-	if (op2 == LW && (op1 == ADD || op1 == BEQ || op1 == NOR) && (field0(instr1) == field1(instr2) || field1(instr1) == field1(instr2)))
-		return 1;
-	if (op2 == LW && (op1 == LW || op1 == SW) && (field0(instr1) == field1(instr2)))
-		return 1;
-	return 0;
+	ringType *ringPtr;
+	batchType *batchPtr = NULL;
+	recordType *recordPtr;
+	pthread_t formatters[MAXFORMATTERS], writer;
+	long batch = 0, hostCpus;
+	int numFormatters, op, addr, halted;
+
+	ringPtr = calloc(1, sizeof(ringType));
+	if (ringPtr == NULL)
+	{
+		printf("error: out of memory for the output ring\n");
+		exit(1);
+	}
+	ringPtr->numMemory = statePtr->numMemory;
+	for (int i = 0; i < NUMBATCHES; i++)
+	{
+		if ((ringPtr->batches[i].dataMem = malloc((statePtr->numMemory + 1) * sizeof(int))) == NULL)
+		{
+			printf("error: out of memory for the output ring\n");
+			exit(1);
+		}
+		atomic_init(&ringPtr->batches[i].filled, 0);
+		atomic_init(&ringPtr->batches[i].formatted, 0);
+	}
+	atomic_init(&ringPtr->claimed, 0);
+	atomic_init(&ringPtr->written, 0);
+	atomic_init(&ringPtr->numBatches, LONG_MAX);
+	pthread_mutex_init(&ringPtr->lock, NULL);
+	pthread_cond_init(&ringPtr->filledCond, NULL);
+	pthread_cond_init(&ringPtr->formattedCond, NULL);
+	pthread_cond_init(&ringPtr->writtenCond, NULL);
+
+	hostCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	numFormatters = hostCpus < 1 ? 1 : (hostCpus > MAXFORMATTERS ? MAXFORMATTERS : hostCpus);
+	for (int t = 0; t < numFormatters; t++)
+		pthread_create(&formatters[t], NULL, formatThread, ringPtr);
+	pthread_create(&writer, NULL, writeThread, ringPtr);
+
+	addr = -1;
+	while (1)
+	{
+		if (batchPtr == NULL)
+		{
+			/* wait for the writer to be done with the slot */
+			ringWait(ringPtr, &ringPtr->written, batch - NUMBATCHES + 1, batch, &ringPtr->writtenCond);
+			batchPtr = &ringPtr->batches[batch % NUMBATCHES];
+			memcpy(batchPtr->dataMem, statePtr->dataMem, statePtr->numMemory * sizeof(int));
+			batchPtr->numRecords = 0;
+		}
+		recordPtr = &batchPtr->records[batchPtr->numRecords++];
+		memcpy(recordPtr->pipeline, statePtr, PIPELINESIZE);
+		recordPtr->storeAddr = addr;
+		if (addr >= 0)
+			recordPtr->storeValue = statePtr->dataMem[addr];
+
+		halted = opcode(statePtr->MEMWB.instr) == HALT;
+		if (halted || batchPtr->numRecords == BATCHCYCLES)
+		{
+			batchPtr->halted = halted;
+			ringPublish(ringPtr, &batchPtr->filled, ++batch, &ringPtr->filledCond);
+			batchPtr = NULL;
+		}
+		if (halted)
+			break;
+
+		op = opcode(statePtr->EXMEM.instr);
+		addr = (op == SW || op == SWAP) ? statePtr->EXMEM.aluResult : -1;
+		runCycle(statePtr);
+	}
+
+	/* wake the formatters and the writer waiting for batches that never come */
+	pthread_mutex_lock(&ringPtr->lock);
+	atomic_store(&ringPtr->numBatches, batch);
+	pthread_cond_broadcast(&ringPtr->filledCond);
+	pthread_cond_broadcast(&ringPtr->formattedCond);
+	pthread_mutex_unlock(&ringPtr->lock);
+	for (int t = 0; t < numFormatters; t++)
+		pthread_join(formatters[t], NULL);
+	pthread_join(writer, NULL);
+	for (int i = 0; i < NUMBATCHES; i++)
+	{
+		free(ringPtr->batches[i].dataMem);
+		free(ringPtr->batches[i].text);
+	}
+	pthread_mutex_destroy(&ringPtr->lock);
+	pthread_cond_destroy(&ringPtr->filledCond);
+	pthread_cond_destroy(&ringPtr->formattedCond);
+	pthread_cond_destroy(&ringPtr->writtenCond);
+	free(ringPtr);
+	return (0);
 }
 
-void
-printState(stateType *statePtr)
+char *
+formatString(char *text, const char *string)
+{
+	while (*string)
+		*text++ = *string++;
+	return text;
+}
+
+/* write the fields of one latch instruction the way printInstruction() prints them */
+char *
+formatInstruction(char *text, int instr)
+{
+	text = formatString(text, opcodeName(instr));
+	*text++ = ' ';
+	text = formatInt(text, field0(instr));
+	*text++ = ' ';
+	text = formatInt(text, field1(instr));
+	*text++ = ' ';
+	text = formatInt(text, field2(instr));
+	*text++ = '\n';
+	return text;
+}
+
+/*
+ * Write what printState() prints into text, which must have room for
+ * STATETEXTSIZE(statePtr->numMemory) characters; return the end of it.
+ */
+char *
+formatState(char *text, stateType *statePtr)
 {
 	int i;
-	printf("\n@@@\nstate before cycle %d starts\n", statePtr->cycles);
-	printf("\tpc %d\n", statePtr->pc);
-	printf("\tdata memory:\n");
+	text = formatString(text, "\n@@@\nstate before cycle ");
+	text = formatInt(text, statePtr->cycles);
+	text = formatString(text, " starts\n\tpc ");
+	text = formatInt(text, statePtr->pc);
+	text = formatString(text, "\n\tdata memory:\n");
 	for (i = 0; i < statePtr->numMemory; i++) {
-		printf("\t\tdataMem[ %d ] %d\n", i, statePtr->dataMem[i]);
+		text = formatString(text, "\t\tdataMem[ ");
+		text = formatInt(text, i);
+		text = formatString(text, " ] ");
+		text = formatInt(text, statePtr->dataMem[i]);
+		*text++ = '\n';
 	}
-	printf("\tregisters:\n");
+	text = formatString(text, "\tregisters:\n");
 	for (i = 0; i < NUMREGS; i++) {
-		printf("\t\treg[ %d ] %d\n", i, statePtr->reg[i]);
+		text = formatString(text, "\t\treg[ ");
+		text = formatInt(text, i);
+		text = formatString(text, " ] ");
+		text = formatInt(text, statePtr->reg[i]);
+		*text++ = '\n';
 	}
-	printf("\tIFID:\n");
-	printf("\t\tinstruction ");
+	text = formatString(text, "\tIFID:\n\t\tinstruction ");
+	text = formatInstruction(text, statePtr->IFID.instr);
+	text = formatString(text, "\t\tpcPlus1 ");
+	text = formatInt(text, statePtr->IFID.pcPlus1);
+	text = formatString(text, "\n\tIDEX:\n\t\tinstruction ");
+	text = formatInstruction(text, statePtr->IDEX.instr);
+	text = formatString(text, "\t\tpcPlus1 ");
+	text = formatInt(text, statePtr->IDEX.pcPlus1);
+	text = formatString(text, "\n\t\treadRegA ");
+	text = formatInt(text, statePtr->IDEX.readRegA);
+	text = formatString(text, "\n\t\treadRegB ");
+	text = formatInt(text, statePtr->IDEX.readRegB);
+	text = formatString(text, "\n\t\toffset ");
+	text = formatInt(text, statePtr->IDEX.offset);
+	text = formatString(text, "\n\tEXMEM:\n\t\tinstruction ");
+	text = formatInstruction(text, statePtr->EXMEM.instr);
+	text = formatString(text, "\t\tbranchTarget ");
+	text = formatInt(text, statePtr->EXMEM.branchTarget);
+	text = formatString(text, "\n\t\taluResult ");
+	text = formatInt(text, statePtr->EXMEM.aluResult);
+	text = formatString(text, "\n\t\treadRegB ");
+	text = formatInt(text, statePtr->EXMEM.readRegB);
+	text = formatString(text, "\n\tMEMWB:\n\t\tinstruction ");
+	text = formatInstruction(text, statePtr->MEMWB.instr);
+	text = formatString(text, "\t\twriteData ");
+	text = formatInt(text, statePtr->MEMWB.writeData);
+	text = formatString(text, "\n\tWBEND:\n\t\tinstruction ");
+	text = formatInstruction(text, statePtr->WBEND.instr);
+	text = formatString(text, "\t\twriteData ");
+	text = formatInt(text, statePtr->WBEND.writeData);
+	*text++ = '\n';
+	return text;
+}
+
+void
+printState(stateType *statePtr)
+{
+	static char text[STATETEXTSIZE(NUMMEMORY)];
+	fwrite(text, 1, formatState(text, statePtr) - text, stdout);
+}
+
+void
+readLabels(debugType *debugPtr, char *fileName)
+{
+	/* labels are the first column of the assembly file, one line per address */
+	char line[1001];
+	char label[MAXLABELLENGTH];
+	FILE *labelPtr;
+	int addr;
+
+	labelPtr = fopen(fileName, "r");
+	if (labelPtr == NULL) {
+		printf("error: can't open file %s", fileName);
+		perror("fopen");
+		exit(1);
+	}
+	for (addr = 0; fgets(line, 1000, labelPtr) != NULL; addr++)
+	{
+		if (debugPtr->numLabels == MAXLABELS)
+			break;
+		if (sscanf(line, "%99[^\t\n\r ]", label) == 1)
+		{
+			strcpy(debugPtr->labels[debugPtr->numLabels].label, label);
+			debugPtr->labels[debugPtr->numLabels].addr = addr;
+			debugPtr->numLabels++;
+		}
+	}
+	fclose(labelPtr);
+}
+
+/* parse an address given as a number or a label; return -1 if unknown */
+int
+debugAddress(debugType *debugPtr, char *arg)
+{
+	int addr;
+	if (sscanf(arg, "%d", &addr) == 1)
+		return (addr >= 0 && addr < NUMMEMORY) ? addr : -1;
+	for (int i = 0; i < debugPtr->numLabels; i++)
+	{
+		if (!strcmp(arg, debugPtr->labels[i].label))
+			return debugPtr->labels[i].addr;
+	}
+	return -1;
+}
+
+void
+printLatches(stateType *statePtr)
+{
+	printf("cycle %d pc %d\n", statePtr->cycles, statePtr->pc);
+	printf("\tIFID  ");
 	printInstruction(statePtr->IFID.instr);
-	printf("\t\tpcPlus1 %d\n", statePtr->IFID.pcPlus1);
-	printf("\tIDEX:\n");
-	printf("\t\tinstruction ");
+	printf("\tIDEX  ");
 	printInstruction(statePtr->IDEX.instr);
-	printf("\t\tpcPlus1 %d\n", statePtr->IDEX.pcPlus1);
-	printf("\t\treadRegA %d\n", statePtr->IDEX.readRegA);
-	printf("\t\treadRegB %d\n", statePtr->IDEX.readRegB);
-	printf("\t\toffset %d\n", statePtr->IDEX.offset);
-	printf("\tEXMEM:\n");
-	printf("\t\tinstruction ");
+	printf("\tEXMEM ");
 	printInstruction(statePtr->EXMEM.instr);
-	printf("\t\tbranchTarget %d\n", statePtr->EXMEM.branchTarget);
-	printf("\t\taluResult %d\n", statePtr->EXMEM.aluResult);
-	printf("\t\treadRegB %d\n", statePtr->EXMEM.readRegB);
-	printf("\tMEMWB:\n");
-	printf("\t\tinstruction ");
+	printf("\tMEMWB ");
 	printInstruction(statePtr->MEMWB.instr);
-	printf("\t\twriteData %d\n", statePtr->MEMWB.writeData);
-	printf("\tWBEND:\n");
-	printf("\t\tinstruction ");
+	printf("\tWBEND ");
 	printInstruction(statePtr->WBEND.instr);
-	printf("\t\twriteData %d\n", statePtr->WBEND.writeData);
 }
 
+/* move the addresses in *tracePtr along the way runCycle() is about to move the latches */
 void
-printInstruction(int instr)
+traceCycle(stateType *statePtr, traceType *tracePtr)
 {
-	char opcodeString[10];
-	if (opcode(instr) == ADD) {
-		strcpy(opcodeString, "add");
-	}
-	else if (opcode(instr) == NOR) {
-		strcpy(opcodeString, "nor");
-	}
-	else if (opcode(instr) == LW) {
-		strcpy(opcodeString, "lw");
-	}
-	else if (opcode(instr) == SW) {
-		strcpy(opcodeString, "sw");
+	/* a beq taken in MEM squashes the three instructions behind it */
+	int squash = opcode(statePtr->EXMEM.instr) == BEQ && statePtr->EXMEM.aluResult == 0;
+	int stall = isDataHazard(statePtr->IFID.instr, statePtr->IDEX.instr);
+
+	tracePtr->WBEND = tracePtr->MEMWB;
+	tracePtr->MEMWB = tracePtr->EXMEM;
+	tracePtr->EXMEM = squash ? -1 : tracePtr->IDEX;
+	tracePtr->IDEX = squash || stall ? -1 : tracePtr->IFID;
+	if (squash)
+		tracePtr->IFID = -1;
+	else if (!stall)
+		tracePtr->IFID = statePtr->pc;
+}
+
+/* advance one cycle, taking a snapshot every SNAPINTERVAL cycles */
+void
+debugCycle(stateType *statePtr, debugType *debugPtr)
+{
+	int slot;
+	if (statePtr->cycles % SNAPINTERVAL == 0 && statePtr->cycles > 0)
+	{
+		slot = (statePtr->cycles / SNAPINTERVAL) % NUMSNAPS;
+		debugPtr->snaps[slot] = *statePtr;
+		debugPtr->snapTraces[slot] = debugPtr->trace;
+		debugPtr->snapCycle[slot] = statePtr->cycles;
 	}
-	else if (opcode(instr) == BEQ) {
-		strcpy(opcodeString, "beq");
+	traceCycle(statePtr, &debugPtr->trace);
+	runCycle(statePtr);
+}
+
+/* return 1 and report if any watched word or register changed */
+int
+debugWatch(stateType *statePtr, debugType *debugPtr)
+{
+	int hit = 0;
+	int addr, reg;
+	for (int i = 0; i < debugPtr->numWatches; i++)
+	{
+		addr = debugPtr->watchAddr[i];
+		if (statePtr->dataMem[addr] != debugPtr->watchValue[i])
+		{
+			printf("watch dataMem[ %d ] %d -> %d\n", addr, debugPtr->watchValue[i],
+				statePtr->dataMem[addr]);
+			debugPtr->watchValue[i] = statePtr->dataMem[addr];
+			hit = 1;
+		}
 	}
-	else if (opcode(instr) == JALR) {
-		strcpy(opcodeString, "jalr");
+	for (int i = 0; i < debugPtr->numWatchRegs; i++)
+	{
+		reg = debugPtr->watchRegs[i];
+		if (statePtr->reg[reg] != debugPtr->watchRegValue[i])
+		{
+			printf("watch reg[ %d ] %d -> %d\n", reg, debugPtr->watchRegValue[i],
+				statePtr->reg[reg]);
+			debugPtr->watchRegValue[i] = statePtr->reg[reg];
+			hit = 1;
+		}
 	}
-	else if (opcode(instr) == HALT) {
-		strcpy(opcodeString, "halt");
+	return hit;
+}
+
+/* restore the state as it was before cycle `target` */
+void
+debugRewind(stateType *statePtr, debugType *debugPtr, int target)
+{
+	int k, slot;
+	*statePtr = *debugPtr->initial;
+	debugPtr->trace = (traceType){ -1, -1, -1, -1, -1 };
+	for (k = target / SNAPINTERVAL; k > 0 && k > target / SNAPINTERVAL - NUMSNAPS; k--)
+	{
+		slot = k % NUMSNAPS;
+		if (debugPtr->snapCycle[slot] == k * SNAPINTERVAL)
+		{
+			*statePtr = debugPtr->snaps[slot];
+			debugPtr->trace = debugPtr->snapTraces[slot];
+			break;
+		}
 	}
-	else if (opcode(instr) == NOOP) {
-		strcpy(opcodeString, "noop");
+	while (statePtr->cycles < target)
+		debugCycle(statePtr, debugPtr);
+	for (int i = 0; i < debugPtr->numWatches; i++)
+		debugPtr->watchValue[i] = statePtr->dataMem[debugPtr->watchAddr[i]];
+	for (int i = 0; i < debugPtr->numWatchRegs; i++)
+		debugPtr->watchRegValue[i] = statePtr->reg[debugPtr->watchRegs[i]];
+}
+
+int
+runDebugger(stateType *statePtr, debugType *debugPtr)
+{
+	char line[1001], cmd[1001], arg[1001];
+	int numArgs, addr, count, done, stepping;
+
+	debugPtr->initial = malloc(sizeof(stateType));
+	debugPtr->snaps = malloc(NUMSNAPS * sizeof(stateType));
+	if (debugPtr->initial == NULL || debugPtr->snaps == NULL)
+	{
+		printf("error: out of memory for debugger snapshots\n");
+		exit(1);
 	}
-	else {
-		strcpy(opcodeString, "data");
+	*debugPtr->initial = *statePtr;
+	debugPtr->trace = (traceType){ -1, -1, -1, -1, -1 };
+	for (int i = 0; i < NUMSNAPS; i++)
+		debugPtr->snapCycle[i] = -1;
+
+	printLatches(statePtr);
+	while (1)
+	{
+		printf("(dbg) ");
+		fflush(stdout);
+		if (fgets(line, 1000, stdin) == NULL)
+			break;
+		arg[0] = '\0';
+		numArgs = sscanf(line, "%1000s %1000s", cmd, arg);
+		if (numArgs < 1)
+			continue;
+
+		if (!strcmp(cmd, "s") || !strcmp(cmd, "si") || !strcmp(cmd, "c"))
+		{
+			/* step n cycles, n completed instructions, or continue */
+			stepping = strcmp(cmd, "c");
+			count = numArgs == 2 ? atoi(arg) : 1;
+			for (done = 0; opcode(statePtr->MEMWB.instr) != HALT; )
+			{
+				if (stepping && done == count)
+					break;
+				debugCycle(statePtr, debugPtr);
+				/* bubbles don't count as instructions, program noops do */
+				if (strcmp(cmd, "si") || debugPtr->trace.WBEND >= 0)
+					done++;
+				if ((debugPtr->numWatches || debugPtr->numWatchRegs) &&
+					debugWatch(statePtr, debugPtr))
+					break;
+				/* past MEM nothing can squash it, so it is really executing */
+				if (debugPtr->trace.MEMWB >= 0 && debugPtr->breakMap[debugPtr->trace.MEMWB])
+				{
+					printf("breakpoint at %d\n", debugPtr->trace.MEMWB);
+					break;
+				}
+			}
+			if (opcode(statePtr->MEMWB.instr) == HALT)
+				printf("machine halted after %d cycles\n", statePtr->cycles);
+			printLatches(statePtr);
+		}
+		else if (!strcmp(cmd, "rs"))
+		{
+			count = numArgs == 2 ? atoi(arg) : 1;
+			if (count > statePtr->cycles)
+				count = statePtr->cycles;
+			debugRewind(statePtr, debugPtr, statePtr->cycles - count);
+			printLatches(statePtr);
+		}
+		else if (!strcmp(cmd, "b") || !strcmp(cmd, "d"))
+		{
+			if ((addr = debugAddress(debugPtr, arg)) < 0)
+				printf("unknown address %s\n", arg);
+			else
+				debugPtr->breakMap[addr] = cmd[0] == 'b';
+		}
+		else if (!strcmp(cmd, "w"))
+		{
+			if ((addr = debugAddress(debugPtr, arg)) < 0 || debugPtr->numWatches == MAXWATCHES)
+				printf("can't watch %s\n", arg);
+			else
+			{
+				debugPtr->watchAddr[debugPtr->numWatches] = addr;
+				debugPtr->watchValue[debugPtr->numWatches++] = statePtr->dataMem[addr];
+			}
+		}
+		else if (!strcmp(cmd, "wr"))
+		{
+			addr = atoi(arg);
+			if (numArgs != 2 || addr < 0 || addr >= NUMREGS || debugPtr->numWatchRegs == NUMREGS)
+				printf("can't watch register %s\n", arg);
+			else
+			{
+				debugPtr->watchRegs[debugPtr->numWatchRegs] = addr;
+				debugPtr->watchRegValue[debugPtr->numWatchRegs++] = statePtr->reg[addr];
+			}
+		}
+		else if (!strcmp(cmd, "p"))
+			printState(statePtr);
+		else if (!strcmp(cmd, "x"))
+		{
+			if ((addr = debugAddress(debugPtr, arg)) < 0)
+				printf("unknown address %s\n", arg);
+			else
+				printf("dataMem[ %d ] %d\n", addr, statePtr->dataMem[addr]);
+		}
+		else if (!strcmp(cmd, "r"))
+		{
+			for (int i = 0; i < NUMREGS; i++)
+				printf("reg[ %d ] %d\n", i, statePtr->reg[i]);
+		}
+		else if (!strcmp(cmd, "q"))
+			break;
+		else
+			printf("commands: s [n]  si [n]  c  rs [n]  b|d <addr|label>  w <addr|label>  wr <reg>  x <addr|label>  r  p  q\n");
 	}
-	printf("%s %d %d %d\n", opcodeString, field0(instr), field1(instr),
-		field2(instr));
-}
\ No newline at end of file
+
+	free(debugPtr->initial);
+	free(debugPtr->snaps);
+	return (0);
+}
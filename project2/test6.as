@@ -0,0 +1,66 @@
+      lw   0 1 one   $reg1 = 1
+      noop           pad the pipeline instead of relying on stalls
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      add  1 1 2     $reg2 = 2
+      sw   0 2 one   one = 2
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      noop
+      halt           long noop runs are skipped with -q
+one   .fill 1
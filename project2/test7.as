@@ -0,0 +1,19 @@
+      lw   0 1 one     $reg1 = 1
+      lw   0 2 count   $reg2 = iterations left
+      nor  0 0 6       $reg6 = -1
+loop  beq  2 0 done    stop when no iterations are left
+lock  add  1 0 3       $reg3 = 1
+      swap 0 3 mutex   $reg3 = mutex, mutex = 1
+      beq  3 0 crit    got the lock if it was free
+      beq  0 0 lock    otherwise spin
+crit  lw   0 4 total
+      add  4 1 5       total++ inside the critical section
+      sw   0 5 total
+      sw   0 0 mutex   release the lock
+      add  2 6 2       iterations--
+      beq  0 0 loop
+done  halt             run with -n <cores>: total ends up cores * count
+one   .fill 1
+count .fill 50
+mutex .fill 0
+total .fill 0
@@ -0,0 +1,46 @@
+      lw   0 1 one     $reg1 = 1
+      lw   0 2 count   $reg2 = iterations left
+      nor  0 0 6       $reg6 = -1
+      add  7 7 3       $reg3 = 2 * core
+      add  3 3 3       $reg3 = 4 * core, so every core has an L1 block of its own
+loop  beq  2 0 done    stop when no iterations are left
+      lw   3 4 slot    $reg4 = slot[core]
+      add  4 2 5       slot[core] += iterations left
+      sw   3 5 slot
+      add  2 6 2       iterations--
+      beq  0 0 loop
+done  halt             run with -n <cores>: every slot ends at count * (count + 1) / 2
+one   .fill 1
+count .fill 200
+slot  .fill 0          slots for up to 8 cores, 4 words apart
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0
+      .fill 0